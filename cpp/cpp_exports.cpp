@@ -10,6 +10,10 @@
 #include "arma_wrapper/armadillo_sparse.h"
 #include <pybind11/stl.h>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "problem.h"
+#include "surv_problem.h"
 
 namespace py = pybind11;
 
@@ -46,7 +50,8 @@ double local_f(const arma::mat &B,
                const arma::mat &X,
                const arma::mat &Y,
                double bw,
-               int ncore);
+               int ncore,
+               const kernel_opts &kopt);
 
 py::dict local_solver(arma::mat B,
                       arma::mat &X,
@@ -62,13 +67,15 @@ py::dict local_solver(arma::mat B,
                       double gtol,
                       int maxitr,
                       int verbose,
-                      int ncore);
+                      int ncore,
+                      const kernel_opts &kopt);
 
 double phd_init(const arma::mat &B,
                 const arma::mat &X,
                 const arma::mat &Y,
                 double bw,
-                int ncore);
+                int ncore,
+                const kernel_opts &kopt);
 
 py::dict phd_solver(arma::mat B,
                     arma::mat &X,
@@ -84,13 +91,15 @@ py::dict phd_solver(arma::mat B,
                     double gtol,
                     int maxitr,
                     int verbose,
-                    int ncore);
+                    int ncore,
+                    const kernel_opts &kopt);
 
 double save_init(const arma::mat &B,
                  const arma::mat &X,
                  const arma::mat &Y,
                  double bw,
-                 int ncore);
+                 int ncore,
+                 const kernel_opts &kopt);
 
 py::dict save_solver(arma::mat B,
                      arma::mat &X,
@@ -106,13 +115,15 @@ py::dict save_solver(arma::mat B,
                      double gtol,
                      int maxitr,
                      int verbose,
-                     int ncore);
+                     int ncore,
+                     const kernel_opts &kopt);
 
 double seff_init(const arma::mat &B,
                  const arma::mat &X,
                  const arma::mat &Y,
                  double bw,
-                 int ncore);
+                 int ncore,
+                 const kernel_opts &kopt);
 
 py::dict seff_solver(arma::mat B,
                      arma::mat &X,
@@ -128,13 +139,15 @@ py::dict seff_solver(arma::mat B,
                      double gtol,
                      int maxitr,
                      int verbose,
-                     int ncore);
+                     int ncore,
+                     const kernel_opts &kopt);
 
 double sir_init(const arma::mat &B,
                 const arma::mat &X,
                 const arma::mat &Y,
                 double bw,
-                int ncore);
+                int ncore,
+                const kernel_opts &kopt);
 
 py::dict sir_solver(arma::mat B,
                     arma::mat &X,
@@ -150,7 +163,8 @@ py::dict sir_solver(arma::mat B,
                     double gtol,
                     int maxitr,
                     int verbose,
-                    int ncore);
+                    int ncore,
+                    const kernel_opts &kopt);
 
 py::dict surv_dm_solver(arma::mat B,
                         const arma::mat &X,
@@ -167,7 +181,8 @@ py::dict surv_dm_solver(arma::mat B,
                         double gtol,
                         int maxitr,
                         int verbose,
-                        int ncore);
+                        int ncore,
+                        const kernel_opts &kopt);
 
 py::dict surv_dn_solver(arma::mat B,
                         const arma::mat &X,
@@ -184,7 +199,8 @@ py::dict surv_dn_solver(arma::mat B,
                         double gtol,
                         int maxitr,
                         int verbose,
-                        int ncore);
+                        int ncore,
+                        const kernel_opts &kopt);
 
 py::dict surv_forward_solver(arma::mat B,
                              const arma::mat &X,
@@ -200,7 +216,10 @@ py::dict surv_forward_solver(arma::mat B,
                              double gtol,
                              int maxitr,
                              int verbose,
-                             int ncore);
+                             int ncore,
+                             const kernel_opts &kopt);
+
+py::dict packed_kernel_info(const arma::mat &X, const arma::mat &R, double diag, int ncore, bool single, int tile);
 
 int main()
 {
@@ -238,22 +257,121 @@ PYBIND11_MODULE(cpp_exports, m)
     py::implicitly_convertible<py_arr<npint>, intcube>();
     py::implicitly_convertible<py_arr<npdouble>, dcube>();
 
+    // kernel options
+    py::class_<kernel_opts>(m, "kernel_opts")
+        .def(py::init<>())
+        .def_readwrite("precision", &kernel_opts::precision, "\"double\" or \"float\" (float kernel tiles, double accumulation)")
+        .def_readwrite("kernel", &kernel_opts::kernel, "\"gaussian\", \"laplace\", \"epanechnikov\", \"biweight\", \"triweight\" or \"epan_legacy\"")
+        .def_readwrite("backend", &kernel_opts::backend, "\"exact\", \"tree\" (k-d tree with pruning to tol), \"ifgt\" (fast Gauss transform, ndr <= 3), \"binned\" (FFT on a grid, ndr <= 2), \"nystrom\" (landmark low rank factor), \"rff\" (random Fourier features) or \"auto\"")
+        .def_readwrite("tol", &kernel_opts::tol, "absolute tolerance on each kernel entry for approximate backends")
+        .def_readwrite("grid", &kernel_opts::grid, "bins per dimension for the binned backend, 0 to pick from tol")
+        .def_readwrite("landmarks", &kernel_opts::landmarks, "landmark rows for nystrom, 0 for min(N, 256)")
+        .def_readwrite("landmark", &kernel_opts::landmark, "\"uniform\" or \"kmeans++\" landmark selection")
+        .def_readwrite("features", &kernel_opts::features, "random Fourier features for rff, 0 for 512")
+        .def_readwrite("seed", &kernel_opts::seed, "random seed of the randomized backends")
+        .def_readwrite("memory", &kernel_opts::memory, "memory budget in bytes, 0 for 80% of physical memory")
+        .def_readwrite("parallel", &kernel_opts::parallel, "\"auto\", \"coordinates\", \"rows\" or \"hybrid\" for the gradient threads");
+
+    // prepared regression problem
+    py::class_<prepared_problem, std::shared_ptr<prepared_problem>>(m, "problem")
+        .def(py::init(&PrepareProblem), "Precalculates the B independent terms of a method once.",
+             py::arg("method"), py::arg("X"), py::arg("Y"), py::arg("ncore"), py::arg("kopt") = kernel_opts())
+        .def_readonly("method", &prepared_problem::method)
+        .def("init", &ProblemInit, "Objective value at B.", py::arg("B"), py::arg("bw"), py::arg("ncore"))
+        .def("solve", &ProblemSolve, "Solver from the start B.",
+             py::arg("B"), py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"),
+             py::arg("epsilon"), py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"),
+             py::arg("verbose"), py::arg("ncore"))
+        .def("solve_multi", &ProblemSolveMulti, "Solver from each start in a list, with the index of the best fit.",
+             py::arg("starts"), py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"),
+             py::arg("epsilon"), py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"),
+             py::arg("verbose"), py::arg("ncore"));
+
+    // prepared survival problem, indices are 0-based
+    py::class_<surv_problem, std::shared_ptr<surv_problem>>(m, "surv_problem")
+        .def(py::init(&PrepareSurv), "Sorts the data by time, groups the ties and builds the risk sets and Phit.",
+             py::arg("time"), py::arg("status"), py::arg("X"), py::arg("phit") = "mean", py::arg("degree") = 2,
+             py::arg("bins") = 0, py::arg("kopt") = kernel_opts())
+        .def_readonly("X", &surv_problem::X)
+        .def_readonly("time", &surv_problem::time)
+        .def_readonly("Phit", &surv_problem::Phit)
+        .def_readonly("bins", &surv_problem::bins)
+        .def_property_readonly("order", [](const surv_problem &p) { return arma::conv_to<arma::vec>::from(p.order); })
+        .def_property_readonly("fail_ind", [](const surv_problem &p) { return arma::conv_to<arma::vec>::from(p.fail_ind); })
+        .def_property_readonly("risk_ind", [](const surv_problem &p) { return arma::conv_to<arma::vec>::from(p.risk_ind); })
+        .def_property_readonly("tie_group", [](const surv_problem &p) { return arma::conv_to<arma::vec>::from(p.tie_group); })
+        .def("solve", &SurvSolve, "Solver of a survival method from the start B.",
+             py::arg("method"), py::arg("B"), py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"),
+             py::arg("tau"), py::arg("epsilon"), py::arg("btol"), py::arg("ftol"), py::arg("gtol"),
+             py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"));
+
     // function export
     m.def("_gen_solver", &gen_solver, "orthodr export function gen_solver");
-    m.def("_local_f", &local_f, "orthodr export function local_f");
-    m.def("_local_solver", &local_solver, "orthodr export function local_solver");
-    m.def("_phd_init", &phd_init, "orthodr export function phd_init");
-    m.def("_phd_solver", &phd_solver, "orthodr export function phd_solver");
-    m.def("_save_init", &save_init, "orthodr export function save_init");
-    m.def("_save_solver", &save_solver, "orthodr export function save_solver");
-    m.def("_seff_init", &seff_init, "orthodr export function seff_init");
-    m.def("_seff_solver", &seff_solver, "orthodr export function seff_solver");
-    m.def("_sir_init", &sir_init, "orthodr export function sir_init");
-    m.def("_sir_solver", &sir_solver, "orthodr export function sir_solver");
-    m.def("_surv_dm_solver", &surv_dm_solver, "orthodr export function surv_dm_solver");
-    m.def("_surv_dn_solver", &surv_dn_solver, "orthodr export function surv_dn_solver");
-    m.def("_surv_forward_solver", &surv_forward_solver, "orthodr export function surv_forward_solver");
-    m.def("_KernelDist_cross", &KernelDist_cross, "orthodr export function KernelDist_cross");
+    m.def("_local_f", &local_f, "orthodr export function local_f",
+          py::arg("B"), py::arg("X"), py::arg("Y"), py::arg("bw"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_local_solver", &local_solver, "orthodr export function local_solver",
+          py::arg("B"), py::arg("X"), py::arg("Y"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_phd_init", &phd_init, "orthodr export function phd_init",
+          py::arg("B"), py::arg("X"), py::arg("Y"), py::arg("bw"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_phd_solver", &phd_solver, "orthodr export function phd_solver",
+          py::arg("B"), py::arg("X"), py::arg("Y"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_save_init", &save_init, "orthodr export function save_init",
+          py::arg("B"), py::arg("X"), py::arg("Y"), py::arg("bw"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_save_solver", &save_solver, "orthodr export function save_solver",
+          py::arg("B"), py::arg("X"), py::arg("Y"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_seff_init", &seff_init, "orthodr export function seff_init",
+          py::arg("B"), py::arg("X"), py::arg("Y"), py::arg("bw"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_seff_solver", &seff_solver, "orthodr export function seff_solver",
+          py::arg("B"), py::arg("X"), py::arg("Y"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_sir_init", &sir_init, "orthodr export function sir_init",
+          py::arg("B"), py::arg("X"), py::arg("Y"), py::arg("bw"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_sir_solver", &sir_solver, "orthodr export function sir_solver",
+          py::arg("B"), py::arg("X"), py::arg("Y"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_surv_dm_solver", &surv_dm_solver, "orthodr export function surv_dm_solver",
+          py::arg("B"), py::arg("X"), py::arg("Phit"), py::arg("Fail_Ind"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_surv_dn_solver", &surv_dn_solver, "orthodr export function surv_dn_solver",
+          py::arg("B"), py::arg("X"), py::arg("Phit"), py::arg("Fail_Ind"),
+          py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_surv_forward_solver", &surv_forward_solver, "orthodr export function surv_forward_solver",
+          py::arg("B"), py::arg("X"), py::arg("Fail_Ind"), py::arg("bw"), py::arg("rho"), py::arg("eta"), py::arg("gamma"), py::arg("tau"), py::arg("epsilon"),
+          py::arg("btol"), py::arg("ftol"), py::arg("gtol"), py::arg("maxitr"), py::arg("verbose"), py::arg("ncore"),
+          py::arg("kopt") = kernel_opts());
+    m.def("_kernel_plan", &kernel_plan_info, "orthodr export function kernel_plan",
+          py::arg("method"), py::arg("N"), py::arg("P"), py::arg("ndr"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_kernel_prod", &kernel_prod_info, "orthodr export function kernel_prod",
+          py::arg("X"), py::arg("R"), py::arg("diag"), py::arg("ncore"), py::arg("kopt") = kernel_opts());
+    m.def("_packed_kernel", &packed_kernel_info, "orthodr export function packed_kernel",
+          py::arg("X"), py::arg("R"), py::arg("diag"), py::arg("ncore"), py::arg("single") = false, py::arg("tile") = 0);
+    m.def("_thread_pool", &thread_pool, "orthodr export function thread_pool", py::arg("ncore") = 0);
+    m.def("_thread_pool_info", &thread_pool_info, "orthodr export function thread_pool_info");
+    m.def("_KernelDist_cross", &KernelDist_cross, "orthodr export function KernelDist_cross",
+          py::arg("TestX"), py::arg("X"), py::arg("ncore") = 0);
+    m.def("_KernelDist_cross_blocks", &KernelDist_cross_blocks, "orthodr export function KernelDist_cross_blocks",
+          py::arg("TestX"), py::arg("X"), py::arg("block"), py::arg("callback"), py::arg("ncore") = 0);
+    m.def("_KernelDist_cross_predict", &KernelDist_cross_predict, "orthodr export function KernelDist_cross_predict",
+          py::arg("TestX"), py::arg("X"), py::arg("Y"), py::arg("ncore") = 0);
+    m.def("_KernelDist_cross_rowsum", &KernelDist_cross_rowsum, "orthodr export function KernelDist_cross_rowsum",
+          py::arg("TestX"), py::arg("X"), py::arg("ncore") = 0);
 
     // test functions
     m.def("main", &main, "Sums2 the elements in the array.");
@@ -0,0 +1,204 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+#include <string>
+#include <memory>
+#include <armadillo>
+#include <pybind11/pybind11.h>
+#include "kernel_registry.h"
+
+#ifndef orthoDr_kernel
+#define orthoDr_kernel
+
+// Per call kernel options, exported to python as kernel_opts.
+//   precision: "double", or "float" to build, store and multiply the kernel tiles
+//              in single precision, with the sums over tiles carried out in double
+//   kernel:    kernel on the scaled BX, "gaussian", "laplace" or one of the compact
+//              support kernels "epanechnikov", "biweight", "triweight" and
+//              "epan_legacy" (the (1 - d^4)^3 weight of EpanKernelDist), which are
+//              stored as sparse neighbor lists. The kernel on Y is always gaussian.
+//   backend:   how gaussian kernel sums are evaluated, "exact" (streaming tiles),
+//              "tree" (k-d tree, dual-tree traversal with pruning) or "ifgt"
+//              (improved fast Gauss transform, for ndr <= 3 and exact otherwise)
+//              "binned" (linear binning and FFT convolution, for ndr <= 2) or
+//              "nystrom" (low rank factor from landmark rows, any ndr) or
+//              "rff" (random Fourier features, any ndr), or "auto" to pick by N and ndr
+//   tol:       absolute tolerance on each kernel entry for approximate backends,
+//              relative eigenvalue cutoff for nystrom
+//   grid:      bins per dimension for the binned backend, 0 to pick from tol
+//   landmarks: landmark rows for nystrom, 0 for min(N, 256)
+//   landmark:  how landmarks are chosen, "uniform" or "kmeans++"
+//   features:  random Fourier features for rff, 0 for 512
+//   seed:      random seed of the randomized backends, fixed so that every
+//              objective evaluation of a fit uses the same approximation
+//   memory:    memory budget in bytes for the planner, 0 for 80% of physical memory
+//   parallel:  what the gradient threads split, "coordinates" of B (one objective
+//              per thread), "rows" of the kernel (one objective at a time), "hybrid"
+//              (coordinates, with the leftover threads on the rows of each objective)
+//              or "auto" to pick by P * ndr, N, ncore and the memory budget
+
+struct kernel_opts
+{
+  std::string precision = "double";
+  std::string kernel = "gaussian";
+  std::string backend = "exact";
+  double tol = 1e-6;
+  int grid = 0;
+  int landmarks = 0;
+  std::string landmark = "uniform";
+  int features = 0;
+  int seed = 1;
+  double memory = 0;
+  std::string parallel = "auto";
+};
+
+// validate the options before any work is done
+void checkKernel(const kernel_opts &kopt);
+bool kernelSingle(const kernel_opts &kopt);
+kernel_type kernelType(const kernel_opts &kopt);
+bool kernelCompact(const kernel_opts &kopt);
+
+// the same options with the gaussian kernel, used for the Y side
+kernel_opts kernelGaussian(const kernel_opts &kopt);
+
+// backend = "auto" resolved for N points in ndr dimensions
+kernel_opts kernelResolve(const kernel_opts &kopt, int N, int ndr);
+
+// Execution plan of a solver: the resolved backend, how the threads of the
+// finite difference gradient are split, and the predicted memory in bytes. Over
+// the memory budget the planner first lowers the threads, then with backend =
+// "auto" switches exact sums to an approximate backend; adjusted records which
+// ("none", "threads" or "backend"), and kopt holds the options the solver runs.
+// single is the thread count of a lone objective evaluation (the initial value
+// and the line search), where the whole pool splits the kernel rows.
+struct kernel_plan
+{
+  std::string method;
+  kernel_opts kopt;
+  std::string adjusted;
+  std::string backend;
+  std::string parallel;
+  int outer;
+  int inner;
+  int single;
+  double shared_bytes;
+  double eval_bytes;
+  double peak_bytes;
+  double budget_bytes;
+  bool fits;
+};
+
+kernel_plan KernelPlan(const std::string &method, int N, int P, int ndr, int ncore, const kernel_opts &kopt);
+pybind11::dict KernelPlanDict(const kernel_plan &plan);
+
+// a clear error when even the adjusted plan does not fit the budget
+void checkPlan(const kernel_plan &plan);
+pybind11::dict kernel_plan_info(std::string method, int N, int P, int ndr, int ncore, const kernel_opts &kopt);
+
+// the approximate backends apply to the gaussian kernel only
+bool kernelTree(const kernel_opts &kopt);
+bool kernelIfgt(const kernel_opts &kopt);
+bool kernelBinned(const kernel_opts &kopt);
+bool kernelNystrom(const kernel_opts &kopt);
+bool kernelRff(const kernel_opts &kopt);
+bool kernelApprox(const kernel_opts &kopt);
+
+// Streaming kernel engine: kernel tiles are computed from the (scaled) points
+// on the fly and multiplied against the right hand sides, so the N x N kernel
+// matrix is never stored.
+
+// K * R
+arma::mat KernelProd(const arma::mat &X, const arma::mat &R, int ncore, double diag,
+                     const kernel_opts &kopt);
+arma::mat kernel_prod_info(const arma::mat &X, const arma::mat &R, double diag, int ncore, const kernel_opts &kopt);
+
+// kernel weighted averages (K * R) / Kx, with the row sums returned in Kx
+arma::mat KernelMoments(const arma::mat &X, const arma::mat &R, arma::rowvec &Kx, int ncore, double diag,
+                        const kernel_opts &kopt);
+
+// Local linear normal equations at every point of X: row i is the column major
+// (ndr + 1) x (ndr + 1) matrix sum_j K_ij [1, x_j - x_i]' [1, x_j - x_i], built from
+// kernel weighted moment sums in one product. K R for extra columns R comes out of
+// the same pass in KR.
+arma::mat KernelLocalGram(const arma::mat &X, const arma::mat &R, arma::mat &KR, int ncore, double diag,
+                          const kernel_opts &kopt);
+
+// solve the batch of normal equations, row i of rhs against row i of gram, by
+// Cholesky with a growing ridge when a matrix is not positive definite
+arma::mat LocalLinearSolve(const arma::mat &gram, const arma::mat &rhs, int ncore);
+
+// risk set sums for the survival objectives, row j is sum_{k >= from(j)} K(at(j), k) [R_k, 1],
+// the last column being the kernel mass of the risk set; from(j) <= at(j) when at(j) is tied
+// with earlier rows, otherwise from = at
+arma::mat KernelRiskSums(const arma::mat &X, const arma::mat &R, const arma::uvec &at, const arma::uvec &from,
+                         int ncore, double diag, const kernel_opts &kopt);
+
+// The N x n block of kernel columns K(, cols), only these columns are evaluated. With
+// risk = true column j is restricted to the risk set k >= cols(j), which is all the
+// survival objectives read, and the exponentials outside it are skipped.
+arma::mat KernelCols(const arma::mat &X, const arma::uvec &cols, int ncore, double diag, const kernel_opts &kopt,
+                     bool risk);
+
+// Streaming gaussian cross kernels between testing data and training data, the
+// TestN x N matrix is only built one block of rows at a time
+void KernelDist_cross_blocks(const arma::mat &TestX, const arma::mat &X, int block, pybind11::function callback,
+                             int ncore);
+arma::mat KernelDist_cross_predict(const arma::mat &TestX, const arma::mat &X, const arma::mat &Y, int ncore);
+arma::vec KernelDist_cross_rowsum(const arma::mat &TestX, const arma::mat &X, int ncore);
+
+// a single gaussian kernel column K(, j)
+arma::vec KernelDist_col(const arma::mat &X, int j, double diag);
+
+// Accuracy of the selected backend at the final B: the kernel mass of a sample
+// of rows against the exact sums, with the backend parameters in use
+pybind11::dict KernelReport(const arma::mat &X, const arma::mat &B, double bw, int ncore,
+                            const kernel_opts &kopt);
+
+class SparseKernel;
+class KdTree;
+
+// Row access to the kernel selected in kopt. row() returns the nonzero entries
+// (index, value) of row i with index >= from in ascending index order. Gaussian
+// and laplace rows are computed from the points on the fly, compact kernels are read from a
+// sparse neighbor structure built once. With an approximate backend the gaussian
+// row is truncated where the kernel falls below tol, found by a k-d tree range search.
+
+class KernelRows
+{
+public:
+  KernelRows(const arma::mat &X, int ncore, double diag, const kernel_opts &kopt);
+
+  void row(int i, int from, arma::uvec &idx, arma::vec &w) const;
+
+  // K(i, j) out of a row returned by row()
+  static double lookup(const arma::uvec &idx, const arma::vec &w, arma::uword j);
+
+private:
+  const arma::mat &X;
+  double diag;
+  kernel_type type;
+  std::shared_ptr<SparseKernel> csr;
+  std::shared_ptr<KdTree> tree;
+  double r2;
+};
+
+#endif
@@ -0,0 +1,162 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <armadillo>
+#include "utilities.h"
+#include "thread_pool.h"
+#include "kernel_binned.h"
+
+BinnedKernel::BinnedKernel(const arma::mat &X, double tol, int grid)
+{
+  N = X.n_rows;
+  ndr = X.n_cols;
+
+  if (!usable())
+    return;
+
+  // keep the grid within memory for the two dimensional case
+  int Mmax = (ndr == 1) ? (1 << 16) : (1 << 10);
+  double reach = sqrt(dmax(-log(tol), 0));
+
+  M.set_size(ndr);
+  nfft.set_size(ndr);
+  kfft.resize(ndr);
+  cell.set_size(N, ndr);
+  frac.set_size(N, ndr);
+
+  for (int d = 0; d < ndr; d++)
+  {
+    double lo = X.col(d).min();
+    double range = X.col(d).max() - lo;
+
+    // linear binning and interpolation miss each 1-d factor by up to delta^2 / 2,
+    // the product of ndr factors by ndr times that
+    int m = (grid > 1) ? grid : (int)ceil(range / sqrt(2 * tol / ndr)) + 1;
+    m = (int)imin(imax(m, 2), Mmax);
+    double delta = (range > 0) ? range / (m - 1) : 1;
+    M(d) = m;
+
+    for (int i = 0; i < N; i++)
+    {
+      double u = (X(i, d) - lo) / delta;
+      int l = (int)imin((int)floor(u), m - 2);
+
+      cell(i, d) = l;
+      frac(i, d) = u - l;
+    }
+
+    // kernel taps up to where the gaussian drops below tol, zero padded so
+    // that the circular convolution does not wrap around
+    int taps = (int)imin((int)ceil(reach / delta), m - 1);
+    int n = 1;
+    while (n < m + taps)
+      n *= 2;
+    nfft(d) = n;
+
+    arma::vec k(n, arma::fill::zeros);
+    for (int t = 0; t <= taps; t++)
+    {
+      k(t) = exp(-(t * delta) * (t * delta));
+      if (t > 0)
+        k(n - t) = k(t);
+    }
+
+    kfft[d] = arma::fft(k);
+  }
+}
+
+arma::mat BinnedKernel::conv(const arma::mat &W, int d) const
+{
+  int m = M(d);
+  arma::mat pad(nfft(d), W.n_cols, arma::fill::zeros);
+  pad.rows(0, m - 1) = W;
+
+  arma::cx_mat F = arma::fft(pad);
+  F.each_col() %= kfft[d];
+
+  arma::mat out = arma::real(arma::ifft(F));
+  return out.rows(0, m - 1);
+}
+
+arma::mat BinnedKernel::prod(const arma::mat &R, int ncore, double diag) const
+{
+  int q = R.n_cols;
+  arma::mat KR(N, q);
+
+  if (ndr == 1)
+  {
+    // linear binning of all columns at once
+    arma::mat G(M(0), q, arma::fill::zeros);
+
+    for (int i = 0; i < N; i++)
+    {
+      G.row(cell(i, 0)) += (1 - frac(i, 0)) * R.row(i);
+      G.row(cell(i, 0) + 1) += frac(i, 0) * R.row(i);
+    }
+
+    G = conv(G, 0);
+
+    parallelFor(N, ncore, [&](int i, int) {
+      KR.row(i) = (1 - frac(i, 0)) * G.row(cell(i, 0)) + frac(i, 0) * G.row(cell(i, 0) + 1);
+    });
+  }
+  else
+  {
+    // one grid per right hand side column
+    parallelFor(q, ncore, [&](int c, int) {
+      arma::mat G(M(0), M(1), arma::fill::zeros);
+
+      for (int i = 0; i < N; i++)
+      {
+        int a = cell(i, 0);
+        int b = cell(i, 1);
+        double f0 = frac(i, 0);
+        double f1 = frac(i, 1);
+        double r = R(i, c);
+
+        G(a, b) += (1 - f0) * (1 - f1) * r;
+        G(a + 1, b) += f0 * (1 - f1) * r;
+        G(a, b + 1) += (1 - f0) * f1 * r;
+        G(a + 1, b + 1) += f0 * f1 * r;
+      }
+
+      G = conv(conv(G, 0).t(), 1).t();
+
+      for (int i = 0; i < N; i++)
+      {
+        int a = cell(i, 0);
+        int b = cell(i, 1);
+        double f0 = frac(i, 0);
+        double f1 = frac(i, 1);
+
+        KR(i, c) = (1 - f0) * (1 - f1) * G(a, b) + f0 * (1 - f1) * G(a + 1, b) +
+                   (1 - f0) * f1 * G(a, b + 1) + f0 * f1 * G(a + 1, b + 1);
+      }
+    });
+  }
+
+  // the binned self weight is close to 1
+  KR += (diag - 1) * R;
+
+  return KR;
+}
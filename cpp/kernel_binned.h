@@ -0,0 +1,67 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <vector>
+#include <armadillo>
+
+#ifndef orthoDr_kernel_binned
+#define orthoDr_kernel_binned
+
+// Binned gaussian kernel sums for ndr = 1 or 2. The weights of the points are
+// spread linearly onto a regular grid, convolved with the gaussian through the
+// FFT (one dimension at a time, the kernel is separable) and interpolated back
+// to the points. grid is the number of bins per dimension; 0 picks the spacing
+// sqrt(2 tol / ndr), which bounds the binning and interpolation error of each
+// entry by tol as long as the grid stays under its size cap.
+
+class BinnedKernel
+{
+public:
+  BinnedKernel(const arma::mat &X, double tol, int grid);
+
+  bool usable() const { return ndr <= 2; }
+
+  // K * R, R is N x q
+  arma::mat prod(const arma::mat &R, int ncore, double diag) const;
+
+  // bins per dimension
+  arma::uvec grid_size() const { return M; }
+
+private:
+  int N;
+  int ndr;
+
+  // bins and fft length per dimension, with the transformed kernel taps
+  arma::uvec M;
+  arma::uvec nfft;
+  std::vector<arma::cx_vec> kfft;
+
+  // lower bin of each point and its position within the bin, N x ndr
+  arma::umat cell;
+  arma::mat frac;
+
+  // discrete convolution of the columns of W with the gaussian along dimension d
+  arma::mat conv(const arma::mat &W, int d) const;
+};
+
+#endif
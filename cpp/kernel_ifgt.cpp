@@ -0,0 +1,335 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <vector>
+#include <armadillo>
+#include "utilities.h"
+#include "thread_pool.h"
+#include "kernel_ifgt.h"
+
+// number of monomials of degree < p in d variables, C(p - 1 + d, d)
+static double n_terms(int p, int d)
+{
+  double n = 1;
+
+  for (int k = 1; k <= d; k++)
+    n = n * (p - 1 + k) / k;
+
+  return n;
+}
+
+// smallest order p with (2 rx ry)^p / p! <= eps, -1 if it is out of reach
+static int taylor_order(double rx, double ry, double eps)
+{
+  double t = 2 * rx * ry;
+  double term = 1;
+  int p = 0;
+
+  while (term > eps)
+  {
+    if (p == 200)
+      return -1;
+
+    p++;
+    term *= t / p;
+  }
+
+  return imax(p, 1);
+}
+
+GaussTransform::GaussTransform(const arma::mat &X, double tol, int ncore)
+{
+  N = X.n_rows;
+  ndr = X.n_cols;
+  K = 0;
+  p = 0;
+  nterms = 0;
+  rx = 0;
+  ry = 0;
+  fast = false;
+
+  // the expansion length grows like p^ndr
+  if (ndr > 3 || N < 2)
+    return;
+
+  Xt = X.t();
+
+  // half of tol for the truncated series, half for the dropped clusters
+  double eps = tol / 2;
+  double cut = sqrt(dmax(-log(eps), 0));
+
+  // farthest point clustering, radius(k) is the largest distance to the nearest
+  // of the first k + 1 centers
+  int Kmax = imin(N, 2 * (int)ceil(sqrt((double)N)));
+  std::vector<int> seed;
+  arma::vec radius(Kmax);
+  arma::vec d2(N);
+  d2.fill(arma::datum::inf);
+  int next = 0;
+
+  for (int k = 0; k < Kmax; k++)
+  {
+    seed.push_back(next);
+    const double *c = Xt.colptr(next);
+
+    parallelFor(N, ncore, [&](int i, int) {
+      const double *x = Xt.colptr(i);
+      double d = 0;
+
+      for (int l = 0; l < ndr; l++)
+        d += (x[l] - c[l]) * (x[l] - c[l]);
+
+      if (d < d2(i))
+        d2(i) = d;
+    });
+
+    next = d2.index_max();
+    radius(k) = sqrt(d2(next));
+
+    if (radius(k) == 0)
+    {
+      radius.resize(k + 1);
+      break;
+    }
+  }
+
+  // cost per target and right hand side column: the distances to all centers
+  // plus the expansions of the clusters within reach, which cover about a
+  // fraction (ry / R0)^ndr of the data, against about N * (ndr + 2) for direct sums
+  double R0 = radius(0);
+  double best = 0.5 * N * (ndr + 2);
+  int best_k = -1;
+
+  for (arma::uword k = 0; k < radius.n_elem; k++)
+  {
+    double r = radius(k);
+    int pk = taylor_order(r, r + cut, eps);
+
+    if (pk < 0)
+      continue;
+
+    double reach = (R0 > 0) ? dmin(1, pow((r + cut) / R0, ndr)) : 1;
+    double cost = (k + 1) * ndr + 2 * n_terms(pk, ndr) * dmax(1, (k + 1) * reach);
+
+    if (cost < best)
+    {
+      best = cost;
+      best_k = k;
+    }
+  }
+
+  if (best_k < 0)
+    return;
+
+  K = best_k + 1;
+  rx = radius(best_k);
+  ry = rx + cut;
+  p = taylor_order(rx, ry, eps);
+  fast = true;
+
+  centers.set_size(ndr, K);
+  for (int k = 0; k < K; k++)
+    centers.col(k) = Xt.col(seed[k]);
+
+  // assign every point to its nearest center
+  label.set_size(N);
+
+  parallelFor(N, ncore, [&](int i, int) {
+    const double *x = Xt.colptr(i);
+    double dbest = arma::datum::inf;
+
+    for (int k = 0; k < K; k++)
+    {
+      const double *c = centers.colptr(k);
+      double d = 0;
+
+      for (int l = 0; l < ndr; l++)
+        d += (x[l] - c[l]) * (x[l] - c[l]);
+
+      if (d < dbest)
+      {
+        dbest = d;
+        label(i) = k;
+      }
+    }
+  });
+
+  std::vector<std::vector<arma::uword>> bucket(K);
+  for (int i = 0; i < N; i++)
+    bucket[label(i)].push_back(i);
+
+  members.resize(K);
+  for (int k = 0; k < K; k++)
+    members[k] = arma::conv_to<arma::uvec>::from(bucket[k]);
+
+  // graded monomials with nondecreasing coordinates so that each one appears
+  // once, the coefficient 2^|a| / a! follows from the parent term
+  std::vector<arma::uword> par(1, 0);
+  std::vector<arma::uword> var(1, 0);
+  std::vector<double> cf(1, 1.0);
+  std::vector<arma::uvec> expo(1, arma::uvec(ndr, arma::fill::zeros));
+  int begin = 0;
+
+  for (int g = 1; g < p; g++)
+  {
+    int end = par.size();
+
+    for (int t = begin; t < end; t++)
+      for (int l = (t == 0) ? 0 : var[t]; l < ndr; l++)
+      {
+        arma::uvec e = expo[t];
+        e(l)++;
+
+        par.push_back(t);
+        var.push_back(l);
+        cf.push_back(cf[t] * 2 / e(l));
+        expo.push_back(e);
+      }
+
+    begin = end;
+  }
+
+  nterms = par.size();
+  parent = arma::conv_to<arma::uvec>::from(par);
+  dim = arma::conv_to<arma::uvec>::from(var);
+  coef = arma::conv_to<arma::vec>::from(cf);
+}
+
+void GaussTransform::weighted_terms(const double *x, const double *c, double *out) const
+{
+  double a[3];
+  double d2 = 0;
+
+  for (int l = 0; l < ndr; l++)
+  {
+    a[l] = x[l] - c[l];
+    d2 += a[l] * a[l];
+  }
+
+  out[0] = exp(-d2);
+
+  for (int t = 1; t < nterms; t++)
+    out[t] = out[parent(t)] * a[dim(t)];
+}
+
+arma::mat GaussTransform::prod(const arma::mat &R, int ncore, double diag) const
+{
+  int q = R.n_cols;
+  double ry2 = ry * ry;
+  arma::cube C(nterms, q, K);
+
+  // source side, C_k = coef % sum over the cluster of terms(x_i - c_k) R_i
+  parallelFor(K, ncore, [&](int k, int) {
+    const arma::uvec &m = members[k];
+    arma::mat M(nterms, m.n_elem);
+
+    for (arma::uword r = 0; r < m.n_elem; r++)
+      weighted_terms(Xt.colptr(m(r)), centers.colptr(k), M.colptr(r));
+
+    C.slice(k) = (M * R.rows(m)).each_col() % coef;
+  });
+
+  arma::mat KR(N, q);
+
+  // target side, only the clusters within ry; term and row buffers per thread
+  std::vector<arma::vec> terms(ncore, arma::vec(nterms));
+  std::vector<arma::rowvec> accs(ncore, arma::rowvec(q));
+
+  parallelFor(N, ncore, [&](int i, int th) {
+    arma::vec &t = terms[th];
+    arma::rowvec &acc = accs[th];
+    const double *y = Xt.colptr(i);
+    acc.zeros();
+
+    for (int k = 0; k < K; k++)
+    {
+      const double *c = centers.colptr(k);
+      double d = 0;
+
+      for (int l = 0; l < ndr; l++)
+        d += (y[l] - c[l]) * (y[l] - c[l]);
+
+      if (d > ry2)
+        continue;
+
+      weighted_terms(y, c, t.memptr());
+      acc += t.t() * C.slice(k);
+    }
+
+    KR.row(i) = acc + (diag - 1) * R.row(i);
+  });
+
+  return KR;
+}
+
+arma::mat GaussTransform::suffix(const arma::mat &R, const arma::uvec &at, const arma::uvec &from, double diag) const
+{
+  int q = R.n_cols;
+  int n = at.n_elem;
+  double ry2 = ry * ry;
+
+  arma::cube C(nterms, q, K, arma::fill::zeros);
+  arma::mat out(n, q);
+  arma::vec t(nterms);
+  arma::rowvec acc(q);
+
+  arma::uvec order = sort_index(from, "descend");
+  int next = N;
+
+  for (int j = 0; j < n; j++)
+  {
+    int i = at(order(j));
+
+    // bring the sources from(j), ..., N - 1 into the expansions
+    while (next > (int)from(order(j)))
+    {
+      next--;
+      int k = label(next);
+
+      weighted_terms(Xt.colptr(next), centers.colptr(k), t.memptr());
+      C.slice(k) += (t % coef) * R.row(next);
+    }
+
+    const double *y = Xt.colptr(i);
+    acc.zeros();
+
+    for (int k = 0; k < K; k++)
+    {
+      const double *c = centers.colptr(k);
+      double d = 0;
+
+      for (int l = 0; l < ndr; l++)
+        d += (y[l] - c[l]) * (y[l] - c[l]);
+
+      if (d > ry2)
+        continue;
+
+      weighted_terms(y, c, t.memptr());
+      acc += t.t() * C.slice(k);
+    }
+
+    out.row(order(j)) = acc + (diag - 1) * R.row(i);
+  }
+
+  return out;
+}
@@ -0,0 +1,81 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <vector>
+#include <armadillo>
+
+#ifndef orthoDr_kernel_ifgt
+#define orthoDr_kernel_ifgt
+
+// Improved fast Gauss transform for sums of exp(-|x_i - x_j|^2) over the scaled
+// points. The points are grouped by farthest point clustering and each cluster
+// is summarised by a truncated multivariate Taylor expansion around its center:
+//   exp(-|y - x|^2) = exp(-|y - c|^2) exp(-|x - c|^2) sum_a 2^|a| / a! (y - c)^a (x - c)^a.
+// Clusters farther than ry from a target are dropped. The truncation order and
+// the cutoff are chosen so that each kernel entry is within tol of the exact one.
+// The number of clusters trades the expansion length against the number of
+// clusters touched per target; usable() is false when no choice beats direct sums.
+
+class GaussTransform
+{
+public:
+  GaussTransform(const arma::mat &X, double tol, int ncore);
+
+  bool usable() const { return fast; }
+
+  // K * R, R is N x q
+  arma::mat prod(const arma::mat &R, int ncore, double diag) const;
+
+  // risk set sums, row j is sum_{k >= from(j)} K(at(j), k) R_k, built by a single
+  // sweep that adds the sources to the expansions in descending index order
+  arma::mat suffix(const arma::mat &R, const arma::uvec &at, const arma::uvec &from, double diag) const;
+
+  int n_clusters() const { return K; }
+  int order() const { return p; }
+
+private:
+  int N;
+  int ndr;
+  int K;
+  int p;
+  int nterms;
+  double rx;
+  double ry;
+  bool fast;
+
+  // points and centers as columns, label is the cluster of each point
+  arma::mat Xt;
+  arma::mat centers;
+  arma::uvec label;
+  std::vector<arma::uvec> members;
+
+  // graded monomials: term t is term parent(t) times coordinate dim(t)
+  arma::uvec parent;
+  arma::uvec dim;
+  arma::vec coef;
+
+  // exp(-|a|^2) a^alpha for every term, a = x - c
+  void weighted_terms(const double *x, const double *c, double *out) const;
+};
+
+#endif
@@ -0,0 +1,127 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <armadillo>
+#include "utilities.h"
+#include "thread_pool.h"
+#include "kernel_nystrom.h"
+
+// gaussian kernel between the rows of A and of B through one GEMM
+static arma::mat cross_kernel(const arma::mat &A, const arma::mat &B, int ncore)
+{
+  arma::mat D = A * B.t();
+  arma::vec sa = sum(square(A), 1);
+  arma::rowvec sb = sum(square(B), 1).t();
+
+  parallelFor(D.n_cols, ncore, [&](int j, int) {
+    for (arma::uword i = 0; i < D.n_rows; i++)
+      D(i, j) = exp(-dmax(sa(i) + sb(j) - 2 * D(i, j), 0));
+  });
+
+  return D;
+}
+
+NystromKernel::NystromKernel(const arma::mat &X, int landmarks, const std::string &method, int seed,
+                             double tol, int ncore)
+{
+  int N = X.n_rows;
+  int M = (landmarks > 0) ? (int)imin(landmarks, N) : (int)imin(N, 256);
+
+  std::mt19937 gen(seed);
+
+  if (method == "kmeans++")
+  {
+    // each new landmark is drawn with probability proportional to the squared
+    // distance to the nearest landmark so far
+    L.set_size(M);
+    arma::vec d2(N);
+    d2.fill(arma::datum::inf);
+    L(0) = std::uniform_int_distribution<int>(0, N - 1)(gen);
+
+    for (int m = 1; m < M; m++)
+    {
+      d2 = arma::min(d2, sum(square(X.each_row() - X.row(L(m - 1))), 1));
+
+      double total = sum(d2);
+      if (total <= 0)
+      {
+        L.resize(m);
+        break;
+      }
+
+      double u = std::uniform_real_distribution<double>(0, total)(gen);
+      int pick = 0;
+      for (double acc = d2(0); acc < u && pick < N - 1; acc += d2(++pick))
+        ;
+
+      L(m) = pick;
+    }
+  }
+  else
+  {
+    // a uniform sample without replacement
+    std::vector<arma::uword> all(N);
+    for (int i = 0; i < N; i++)
+      all[i] = i;
+    std::shuffle(all.begin(), all.end(), gen);
+
+    L = arma::sort(arma::conv_to<arma::uvec>::from(std::vector<arma::uword>(all.begin(), all.begin() + M)));
+  }
+
+  arma::mat C = cross_kernel(X, X.rows(L), ncore);
+  arma::mat W = C.rows(L);
+
+  arma::vec lambda;
+  arma::mat U;
+  eig_sym(lambda, U, W);
+
+  // pseudo inverse on the leading eigenvalues only
+  arma::uvec keep = find(lambda > tol * lambda.max());
+  F = C * U.cols(keep) * arma::diagmat(1 / sqrt(lambda(keep)));
+}
+
+arma::mat NystromKernel::prod(const arma::mat &R, int ncore, double diag) const
+{
+  arma::mat KR = F * (F.t() * R);
+
+  // replace the approximate diagonal by the exact one
+  arma::vec dF = sum(square(F), 1);
+  KR += R.each_col() % (diag - dF);
+
+  return KR;
+}
+
+double NystromKernel::approx_error(const arma::mat &X, int ncore) const
+{
+  int N = X.n_rows;
+  int m = imin(N, 100);
+  arma::uvec rows = arma::conv_to<arma::uvec>::from(arma::floor(arma::linspace(0, N - 1, m)));
+
+  arma::mat K = cross_kernel(X.rows(rows), X, ncore);
+  arma::mat K_hat = F.rows(rows) * F.t();
+
+  return norm(K - K_hat, "fro") / norm(K, "fro");
+}
@@ -0,0 +1,55 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <string>
+#include <armadillo>
+
+#ifndef orthoDr_kernel_nystrom
+#define orthoDr_kernel_nystrom
+
+// Nystrom approximation of the gaussian kernel, K ~ C W^+ C' with C = K(, L)
+// and W = K(L, L) for a set L of landmark rows, chosen uniformly at random or
+// by k-means++ seeding. W^+ keeps the eigenvalues above tol times the largest,
+// and the product is stored as the N x rank factor F = C U S^(-1/2), so every
+// kernel weighted sum is the two thin products F (F' R). The diagonal is exact.
+
+class NystromKernel
+{
+public:
+  NystromKernel(const arma::mat &X, int landmarks, const std::string &method, int seed, double tol, int ncore);
+
+  // K * R, R is N x q
+  arma::mat prod(const arma::mat &R, int ncore, double diag) const;
+
+  int rank() const { return F.n_cols; }
+  int n_landmarks() const { return L.n_elem; }
+
+  // relative Frobenius error |K - F F'| / |K| over a sample of up to 100 rows
+  double approx_error(const arma::mat &X, int ncore) const;
+
+private:
+  arma::uvec L;
+  arma::mat F;
+};
+
+#endif
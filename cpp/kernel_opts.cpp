@@ -0,0 +1,131 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+
+void checkKernel(const kernel_opts &kopt)
+{
+  if (kopt.precision != "double" && kopt.precision != "float")
+    throw std::runtime_error("kernel_opts.precision must be \"double\" or \"float\".");
+
+  kernelType(kopt);
+
+  if (kopt.backend != "exact" && kopt.backend != "tree" && kopt.backend != "ifgt" && kopt.backend != "binned" &&
+      kopt.backend != "nystrom" && kopt.backend != "rff" && kopt.backend != "auto")
+    throw std::runtime_error("kernel_opts.backend must be one of \"exact\", \"tree\", \"ifgt\", \"binned\", \"nystrom\", \"rff\", \"auto\".");
+
+  if (!(kopt.tol > 0))
+    throw std::runtime_error("kernel_opts.tol must be positive.");
+
+  if (kopt.grid < 0 || kopt.grid == 1)
+    throw std::runtime_error("kernel_opts.grid must be 0 or at least 2.");
+
+  if (kopt.landmarks < 0)
+    throw std::runtime_error("kernel_opts.landmarks must be nonnegative.");
+
+  if (kopt.landmark != "uniform" && kopt.landmark != "kmeans++")
+    throw std::runtime_error("kernel_opts.landmark must be \"uniform\" or \"kmeans++\".");
+
+  if (kopt.features < 0)
+    throw std::runtime_error("kernel_opts.features must be nonnegative.");
+
+  if (kopt.memory < 0)
+    throw std::runtime_error("kernel_opts.memory must be nonnegative.");
+
+  if (kopt.parallel != "auto" && kopt.parallel != "coordinates" && kopt.parallel != "rows" &&
+      kopt.parallel != "hybrid")
+    throw std::runtime_error("kernel_opts.parallel must be one of \"auto\", \"coordinates\", \"rows\", \"hybrid\".");
+}
+
+bool kernelSingle(const kernel_opts &kopt)
+{
+  return kopt.precision == "float";
+}
+
+kernel_type kernelType(const kernel_opts &kopt)
+{
+  if (kopt.kernel == "gaussian")
+    return KERNEL_GAUSSIAN;
+  if (kopt.kernel == "epanechnikov")
+    return KERNEL_EPANECHNIKOV;
+  if (kopt.kernel == "biweight")
+    return KERNEL_BIWEIGHT;
+  if (kopt.kernel == "triweight")
+    return KERNEL_TRIWEIGHT;
+  if (kopt.kernel == "laplace")
+    return KERNEL_LAPLACE;
+  if (kopt.kernel == "epan_legacy")
+    return KERNEL_EPAN_LEGACY;
+
+  throw std::runtime_error("kernel_opts.kernel must be one of \"gaussian\", \"epanechnikov\", \"biweight\", \"triweight\", \"laplace\", \"epan_legacy\".");
+}
+
+bool kernelCompact(const kernel_opts &kopt)
+{
+  return kernelDispatch(kernelType(kopt), [](auto kern) { return decltype(kern)::compact; });
+}
+
+// the approximate backends expand the gaussian
+static bool kernelApproxable(const kernel_opts &kopt)
+{
+  return kernelType(kopt) == KERNEL_GAUSSIAN;
+}
+
+bool kernelTree(const kernel_opts &kopt)
+{
+  return kopt.backend == "tree" && kernelApproxable(kopt);
+}
+
+bool kernelIfgt(const kernel_opts &kopt)
+{
+  return kopt.backend == "ifgt" && kernelApproxable(kopt);
+}
+
+bool kernelBinned(const kernel_opts &kopt)
+{
+  return kopt.backend == "binned" && kernelApproxable(kopt);
+}
+
+bool kernelNystrom(const kernel_opts &kopt)
+{
+  return kopt.backend == "nystrom" && kernelApproxable(kopt);
+}
+
+bool kernelRff(const kernel_opts &kopt)
+{
+  return kopt.backend == "rff" && kernelApproxable(kopt);
+}
+
+bool kernelApprox(const kernel_opts &kopt)
+{
+  return kopt.backend != "exact" && kernelApproxable(kopt);
+}
+
+kernel_opts kernelGaussian(const kernel_opts &kopt)
+{
+  kernel_opts gauss = kopt;
+  gauss.kernel = "gaussian";
+
+  return gauss;
+}
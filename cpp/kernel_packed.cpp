@@ -0,0 +1,258 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+#include <unistd.h>
+#include <armadillo>
+#include "utilities.h"
+#include "thread_pool.h"
+#include "kernel_packed.h"
+
+int kernel_tile_size()
+{
+  static int T = 0;
+
+  if (T > 0)
+    return T;
+
+  long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+  if (l2 <= 0)
+    l2 = 256 * 1024;
+
+  // half of L2 for one tile, the other half for the right hand side and output
+  int t = (int)sqrt((double)l2 / 2 / sizeof(double));
+  t = t - t % 16;
+
+  T = (int)imin(imax(t, 32), 1024);
+  return T;
+}
+
+PackedKernel::PackedKernel(const arma::mat &X, int ncore, double diag, bool single, int tile)
+{
+  N = X.n_rows;
+  T = (tile > 0) ? tile : kernel_tile_size();
+  nb = (N + T - 1) / T;
+  this->single = single;
+
+  // lay out the upper triangle tiles row by row
+  offset.assign(nb * nb, 0);
+  arma::uword total = 0;
+
+  for (int bi = 0; bi < nb; bi++)
+    for (int bj = bi; bj < nb; bj++)
+    {
+      offset[bi * nb + bj] = total;
+      total += (arma::uword)block_rows(bi) * block_rows(bj);
+    }
+
+  if (single)
+  {
+    fdata.set_size(total);
+    fill(X, ncore, diag, fdata.memptr());
+  }
+  else
+  {
+    data.set_size(total);
+    fill(X, ncore, diag, data.memptr());
+  }
+}
+
+template <typename eT>
+void PackedKernel::fill(const arma::mat &X, int ncore, double diag, eT *out)
+{
+  std::vector<int> pair_i;
+  std::vector<int> pair_j;
+
+  for (int bi = 0; bi < nb; bi++)
+    for (int bj = bi; bj < nb; bj++)
+    {
+      pair_i.push_back(bi);
+      pair_j.push_back(bj);
+    }
+
+  // points as columns for contiguous access
+  const arma::mat Xt = X.t();
+  int ndr = X.n_cols;
+  int npair = pair_i.size();
+
+  parallelFor(npair, ncore, [&](int p, int) {
+    int bi = pair_i[p];
+    int bj = pair_j[p];
+    int rb = block_rows(bi);
+    int cb = block_rows(bj);
+    eT *ptr = out + offset[bi * nb + bj];
+
+    for (int c = 0; c < cb; c++)
+    {
+      const double *xc = Xt.colptr(bj * T + c);
+
+      for (int r = 0; r < rb; r++)
+      {
+        const double *xr = Xt.colptr(bi * T + r);
+        double d2 = 0;
+
+        for (int k = 0; k < ndr; k++)
+          d2 += (xr[k] - xc[k]) * (xr[k] - xc[k]);
+
+        ptr[r + c * rb] = (eT)exp(-d2);
+      }
+    }
+
+    if (bi == bj)
+      for (int r = 0; r < rb; r++)
+        ptr[r + r * rb] = (eT)diag;
+  });
+}
+
+double PackedKernel::operator()(int i, int j) const
+{
+  if (i > j)
+    std::swap(i, j);
+
+  int bi = i / T;
+  int bj = j / T;
+
+  return at(offset[bi * nb + bj] + (i - bi * T) + (j - bj * T) * block_rows(bi));
+}
+
+arma::vec PackedKernel::col(int j) const
+{
+  arma::vec out(N);
+  int bj = j / T;
+  int c = j - bj * T;
+
+  for (int bi = 0; bi < nb; bi++)
+  {
+    int rb = block_rows(bi);
+
+    if (bi <= bj)
+    {
+      // column c of tile (bi, bj)
+      arma::uword k0 = offset[bi * nb + bj] + c * rb;
+
+      for (int r = 0; r < rb; r++)
+        out(bi * T + r) = at(k0 + r);
+    }
+    else
+    {
+      // row c of tile (bj, bi)
+      arma::uword k0 = offset[bj * nb + bi] + c;
+      int lda = block_rows(bj);
+
+      for (int r = 0; r < rb; r++)
+        out(bi * T + r) = at(k0 + r * lda);
+    }
+  }
+
+  return out;
+}
+
+arma::rowvec PackedKernel::rowsum(int ncore) const
+{
+  return mult(arma::ones(N, 1), ncore).t();
+}
+
+arma::mat PackedKernel::mult(const arma::mat &R, int ncore) const
+{
+  if (single)
+    return mult_tiles(R, fdata.memptr(), ncore);
+
+  return mult_tiles(R, data.memptr(), ncore);
+}
+
+template <typename eT>
+arma::mat PackedKernel::mult_tiles(const arma::mat &R, const eT *base, int ncore) const
+{
+  int q = R.n_cols;
+  arma::mat KR(N, q, arma::fill::zeros);
+
+  // each thread owns a block of output rows, so no reduction is needed
+  parallelFor(nb, ncore, [&](int bi, int) {
+    int rb = block_rows(bi);
+    arma::mat acc(rb, q, arma::fill::zeros);
+
+    for (int bj = 0; bj < nb; bj++)
+    {
+      int cb = block_rows(bj);
+
+      // tile products in the storage precision, their sums in double
+      if (bi <= bj)
+      {
+        const arma::Mat<eT> K_ij(const_cast<eT *>(base + offset[bi * nb + bj]), rb, cb, false, true);
+        tileMultAdd(acc, K_ij, R.rows(bj * T, bj * T + cb - 1));
+      }
+      else
+      {
+        const arma::Mat<eT> K_ji(const_cast<eT *>(base + offset[bj * nb + bi]), cb, rb, false, true);
+        tileMultAdd(acc, K_ji, R.rows(bj * T, bj * T + cb - 1), true);
+      }
+    }
+
+    KR.rows(bi * T, bi * T + rb - 1) = acc;
+  });
+
+  return KR;
+}
+
+//' @title packed_kernel
+//' @name packed_kernel
+//' @description The packed gaussian kernel of X read back by column, by entry and through its products
+//' @keywords internal
+//' @param X The points, N x ndr
+//' @param R The right hand sides, N x q
+//' @param diag The diagonal of the kernel
+//' @param ncore Number of cores, 0 for all
+//' @param single Whether the tiles are stored as float
+//' @param tile The tile edge length, 0 for the cache based default
+// [[Rcpp::export]]
+py::dict packed_kernel_info(const arma::mat &X, const arma::mat &R, double diag, int ncore, bool single, int tile)
+{
+  checkCores(ncore, 0);
+
+  if (R.n_rows != X.n_rows)
+    throw std::runtime_error("R must have one row per point of X.");
+
+  PackedKernel K(X, ncore, diag, single, tile);
+  int N = X.n_rows;
+
+  arma::mat cols(N, N);
+  arma::mat entries(N, N);
+
+  for (int j = 0; j < N; j++)
+  {
+    cols.col(j) = K.col(j);
+
+    for (int i = 0; i < N; i++)
+      entries(i, j) = K(i, j);
+  }
+
+  py::dict ret;
+  ret["cols"] = cols;
+  ret["entries"] = entries;
+  ret["mult"] = K.mult(R, ncore);
+  ret["rowsum"] = arma::mat(K.rowsum(ncore));
+  ret["tile"] = K.tile();
+  ret["bytes"] = K.n_bytes();
+  return (ret);
+}
@@ -0,0 +1,100 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+#include <vector>
+#include <armadillo>
+
+#ifndef orthoDr_kernel_packed
+#define orthoDr_kernel_packed
+
+// tile edge length (in rows) so that one double tile fills about half of the L2 cache
+int kernel_tile_size();
+
+// acc += K * R (K' * R with trans). A float tile is multiplied in float against
+// the rows of R rounded to float, and the tile products are summed in double, so
+// only the sums within one tile carry single precision rounding
+inline void tileMultAdd(arma::mat &acc, const arma::mat &K, const arma::mat &R, bool trans = false)
+{
+  if (trans)
+    acc += K.t() * R;
+  else
+    acc += K * R;
+}
+
+inline void tileMultAdd(arma::mat &acc, const arma::fmat &K, const arma::mat &R, bool trans = false)
+{
+  const arma::fmat Rf = arma::conv_to<arma::fmat>::from(R);
+
+  if (trans)
+    acc += arma::conv_to<arma::mat>::from(K.t() * Rf);
+  else
+    acc += arma::conv_to<arma::mat>::from(K * Rf);
+}
+
+// Symmetric Gaussian kernel matrix stored as the upper triangle of T x T tiles.
+// Tile (bi, bj), bi <= bj, is a dense column-major block kept contiguously, so
+// only about N^2 / 2 entries are stored and each tile is built and read in cache.
+// With single = true the entries are kept as float and multiplied in float, one
+// tile at a time, with the sums over tiles in double.
+
+class PackedKernel
+{
+public:
+  PackedKernel(const arma::mat &X, int ncore, double diag, bool single = false, int tile = 0);
+
+  double operator()(int i, int j) const;
+
+  // column j of the kernel (equal to row j)
+  arma::vec col(int j) const;
+
+  // column sums, equal to the row sums since the kernel is symmetric
+  arma::rowvec rowsum(int ncore) const;
+
+  // kernel weighted products K * R, R is N x q
+  arma::mat mult(const arma::mat &R, int ncore) const;
+
+  int n_rows() const { return N; }
+  int tile() const { return T; }
+  double n_bytes() const { return (double)(data.n_elem * sizeof(double) + fdata.n_elem * sizeof(float)); }
+
+private:
+  int N;
+  int T;
+  int nb;
+  bool single;
+
+  // start of tile (bi, bj) in data, only bi <= bj is used
+  std::vector<arma::uword> offset;
+  arma::vec data;
+  arma::fvec fdata;
+
+  int block_rows(int b) const { return (b == nb - 1) ? N - b * T : T; }
+  double at(arma::uword k) const { return single ? (double)fdata[k] : data[k]; }
+
+  template <typename eT>
+  void fill(const arma::mat &X, int ncore, double diag, eT *out);
+
+  template <typename eT>
+  arma::mat mult_tiles(const arma::mat &R, const eT *base, int ncore) const;
+};
+
+#endif
@@ -0,0 +1,296 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <unistd.h>
+#include <sstream>
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+#include "kernel_packed.h"
+#include "thread_pool.h"
+#include "problem.h"
+
+// the cheapest approximation of the gaussian sums in ndr dimensions
+static std::string approxBackend(int ndr)
+{
+  if (ndr <= 2)
+    return "binned";
+  if (ndr <= 3)
+    return "ifgt";
+  if (ndr <= 6)
+    return "tree";
+  return "nystrom";
+}
+
+kernel_opts kernelResolve(const kernel_opts &kopt, int N, int ndr)
+{
+  if (kopt.backend != "auto")
+    return kopt;
+
+  // exact sums are affordable up to a few hundred million kernel entries,
+  // beyond that the cheapest approximation for the dimension
+  kernel_opts resolved = kopt;
+
+  resolved.backend = (kernelCompact(kopt) || N <= 20000) ? "exact" : approxBackend(ndr);
+
+  return resolved;
+}
+
+static double memoryBudget(const kernel_opts &kopt)
+{
+  if (kopt.memory > 0)
+    return kopt.memory;
+
+  double phys = 0;
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGE_SIZE)
+  phys = (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGE_SIZE);
+#endif
+
+  // leave room for the interpreter and the caller's copies
+  return (phys > 0) ? 0.8 * phys : 8.0 * (1 << 30);
+}
+
+// memory allocated once per solver call: data and precomputed structures
+static double sharedBytes(const std::string &method, double N, double P, const kernel_opts &kopt)
+{
+  double w = kernelSingle(kopt) ? 4 : 8;
+  double bytes = N * P * 8;
+
+  if (method == "sir")
+    bytes += N * P * 8;
+  else if (method == "save")
+    bytes += 3 * N * P * 8 + 2 * N * 8;
+  else if (method == "seff")
+    bytes += N * N / 2 * w;
+
+  return bytes;
+}
+
+// working memory of one objective evaluation with inner threads
+static double evalBytes(const std::string &method, double N, double P, int ndr, int inner, const kernel_opts &kopt)
+{
+  double w = kernelSingle(kopt) ? 4 : 8;
+  double T = kernel_tile_size();
+
+  // right hand sides of the kernel moments and the kernel rows in flight
+  double q = P + 1;
+  bool rows = false;
+
+  if (method == "sir")
+    q = 2 * P + 1;
+  else if (method == "phd")
+    q = 2;
+  else if (method == "save")
+    q = saveBlock(P) * P;
+  else if (method == "dm")
+    rows = true;
+
+  // [1, BX, BX_k BX_l, the right hand sides] of the local linear normal equations
+  if (method == "local" || method == "seff")
+  {
+    q = dmax(P + 1, (ndr + 1) * (ndr + 4) / 2.0);
+    rows = (method == "seff");
+  }
+
+  double bytes = N * ndr * 8 + 2 * N * q * 8;
+
+  // E[X | BX], its residual and the Mxy weighted sum next to the blocks X_p X (save),
+  // the fixed order partial sums of the group residuals, at most N groups (dm)
+  if (method == "save")
+    bytes += 3 * N * P * 8 + N * q * 8;
+  else if (method == "dm")
+    bytes += dmin(reduce_chunks * P * N * 8, 1e9 + P * N * 8);
+
+  if (rows)
+    bytes += inner * N * 16;
+
+  if (kernelCompact(kopt))
+    bytes += N * 64 * 16;
+  else if (kopt.backend == "exact")
+    bytes += inner * (T * T * w + T * q * 8);
+  else if (kopt.backend == "tree")
+    bytes += 2 * N * (ndr + 3) * 8;
+  else if (kopt.backend == "ifgt")
+    bytes += 2 * sqrt(N) * 256 * q * 8;
+  else if (kopt.backend == "binned")
+    bytes += (ndr == 1) ? 65536.0 * 16 * q : 1048576.0 * 16 * inner;
+  else if (kopt.backend == "nystrom")
+    bytes += 2 * N * ((kopt.landmarks > 0) ? kopt.landmarks : dmin(N, 256)) * 8;
+  else if (kopt.backend == "rff")
+    bytes += inner * 1024.0 * ((kopt.features > 0) ? kopt.features : 512) * 8;
+
+  return bytes;
+}
+
+// the thread split for the resolved options, with the threads lowered one at a
+// time while the predicted peak is over the budget
+static kernel_plan planThreads(const std::string &method, int N, int P, int ndr, int ncore,
+                               const kernel_opts &kopt, const kernel_opts &resolved, double budget)
+{
+  kernel_plan plan;
+  plan.method = method;
+  plan.kopt = resolved;
+  plan.backend = resolved.backend;
+  plan.budget_bytes = budget;
+  plan.shared_bytes = sharedBytes(method, N, P, resolved);
+  plan.adjusted = "none";
+
+  // Threads over the coordinates of B (one objective per thread), over the
+  // kernel rows of one objective at a time, or both: the coordinates take what
+  // they can use and the leftover threads split the rows of each objective. The
+  // rows are split in tiles, so no more inner threads than row tiles.
+  int coords = P * ndr;
+  int tiles = (N + kernel_tile_size() - 1) / kernel_tile_size();
+  int outer_h = imin(ncore, coords);
+  int inner_h = imax(1, imin(ncore / outer_h, tiles));
+  int inner_r = imax(1, imin(ncore, tiles));
+
+  double peak_c = plan.shared_bytes + outer_h * evalBytes(method, N, P, ndr, 1, resolved);
+  double peak_h = plan.shared_bytes + outer_h * evalBytes(method, N, P, ndr, inner_h, resolved);
+  double peak_r = plan.shared_bytes + evalBytes(method, N, P, ndr, inner_r, resolved);
+
+  std::string parallel = kopt.parallel;
+  if (parallel == "auto")
+  {
+    if (peak_h <= budget || peak_h <= peak_r)
+      parallel = (inner_h > 1) ? "hybrid" : "coordinates";
+    else if (peak_c <= budget || peak_c <= peak_r)
+      parallel = "coordinates";
+    else
+      parallel = "rows";
+
+    // a single coordinate level only leaves the rows to split
+    if (parallel != "coordinates" && outer_h == 1)
+      parallel = "rows";
+  }
+
+  plan.parallel = parallel;
+  plan.outer = (parallel == "rows") ? 1 : outer_h;
+  plan.inner = (parallel == "coordinates") ? 1 : (parallel == "rows") ? inner_r : inner_h;
+
+  // each thread holds its own working memory, fewer threads before anything else
+  for (;;)
+  {
+    plan.eval_bytes = evalBytes(method, N, P, ndr, plan.inner, resolved);
+    plan.peak_bytes = plan.shared_bytes + plan.outer * plan.eval_bytes;
+    plan.fits = plan.peak_bytes <= budget;
+
+    if (plan.fits || plan.outer * plan.inner == 1)
+      break;
+
+    if (plan.outer > 1)
+      plan.outer--;
+    else
+      plan.inner--;
+
+    plan.adjusted = "threads";
+  }
+
+  // a lone evaluation runs on the rows only, under the same budget
+  plan.single = inner_r;
+  while (plan.single > 1 &&
+         plan.shared_bytes + evalBytes(method, N, P, ndr, plan.single, resolved) > budget)
+    plan.single--;
+
+  return plan;
+}
+
+kernel_plan KernelPlan(const std::string &method, int N, int P, int ndr, int ncore, const kernel_opts &kopt)
+{
+  if (method != "sir" && method != "save" && method != "phd" && method != "local" && method != "seff" &&
+      method != "dn" && method != "forward" && method != "dm")
+    throw std::runtime_error("unknown method \"" + method + "\" for the kernel plan.");
+
+  double budget = memoryBudget(kopt);
+  kernel_plan plan = planThreads(method, N, P, ndr, ncore, kopt, kernelResolve(kopt, N, ndr), budget);
+
+  // With backend = "auto" the budget also picks the backend: exact sums that do
+  // not fit even on one thread give way to the approximation for the dimension.
+  // The approximate backends expand the gaussian only.
+  if (!plan.fits && kopt.backend == "auto" && plan.backend == "exact" && kernelType(kopt) == KERNEL_GAUSSIAN)
+  {
+    kernel_opts approx = plan.kopt;
+    approx.backend = approxBackend(ndr);
+
+    kernel_plan alt = planThreads(method, N, P, ndr, ncore, kopt, approx, budget);
+
+    if (alt.peak_bytes < plan.peak_bytes)
+    {
+      plan = alt;
+      plan.adjusted = "backend";
+    }
+  }
+
+  return plan;
+}
+
+void checkPlan(const kernel_plan &plan)
+{
+  if (plan.fits)
+    return;
+
+  std::ostringstream msg;
+  msg << "the " << plan.method << " solver needs about " << plan.peak_bytes / (1 << 20) << " MB with the "
+      << plan.backend << " backend on one thread, over the memory budget of " << plan.budget_bytes / (1 << 20)
+      << " MB; use an approximate kernel_opts.backend (or \"auto\") or raise kernel_opts.memory.";
+
+  throw std::runtime_error(msg.str());
+}
+
+py::dict KernelPlanDict(const kernel_plan &plan)
+{
+  py::dict ret;
+  ret["method"] = plan.method;
+  ret["backend"] = plan.backend;
+  ret["parallel"] = plan.parallel;
+  ret["outer_threads"] = plan.outer;
+  ret["inner_threads"] = plan.inner;
+  ret["total_threads"] = plan.outer * plan.inner;
+  ret["eval_threads"] = plan.single;
+  ret["adjusted"] = plan.adjusted;
+  ret["shared_bytes"] = plan.shared_bytes;
+  ret["eval_bytes"] = plan.eval_bytes;
+  ret["peak_bytes"] = plan.peak_bytes;
+  ret["budget_bytes"] = plan.budget_bytes;
+  ret["fits"] = plan.fits;
+  return (ret);
+}
+
+//' @title kernel_plan
+//' @name kernel_plan
+//' @description The kernel strategy, thread split and predicted peak memory a solver would use
+//' @keywords internal
+//' @param method One of "sir", "save", "phd", "local", "seff", "dn", "forward", "dm"
+//' @param N Number of observations
+//' @param P Number of covariates
+//' @param ndr The number of directions
+//' @param ncore Number of cores, 0 for all
+//' @param kopt Kernel options, see \code{kernel_opts}
+// [[Rcpp::export]]
+py::dict kernel_plan_info(std::string method, int N, int P, int ndr, int ncore, const kernel_opts &kopt)
+{
+  checkCores(ncore, 0);
+  checkKernel(kopt);
+
+  return KernelPlanDict(KernelPlan(method, N, P, ndr, ncore, kopt));
+}
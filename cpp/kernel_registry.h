@@ -0,0 +1,116 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <cmath>
+
+#ifndef orthoDr_kernel_registry
+#define orthoDr_kernel_registry
+
+// Kernel functors on the squared scaled distance d2. Each kernel is a type, so
+// the kernel builders take it as a template parameter and the value is inlined
+// into their inner loops. Compact kernels vanish for d2 >= 1 and are stored as
+// sparse neighbor lists. A new kernel is a functor here, an entry in
+// kernel_type and kernelDispatch, and its name in kernelType().
+
+enum kernel_type
+{
+  KERNEL_GAUSSIAN,
+  KERNEL_EPANECHNIKOV,
+  KERNEL_BIWEIGHT,
+  KERNEL_TRIWEIGHT,
+  KERNEL_LAPLACE,
+  KERNEL_EPAN_LEGACY
+};
+
+struct GaussianKernel
+{
+  static constexpr bool compact = false;
+
+  template <typename eT>
+  static eT value(eT d2) { return std::exp(-d2); }
+};
+
+struct LaplaceKernel
+{
+  static constexpr bool compact = false;
+
+  template <typename eT>
+  static eT value(eT d2) { return std::exp(-std::sqrt(d2)); }
+};
+
+struct EpanechnikovKernel
+{
+  static constexpr bool compact = true;
+
+  template <typename eT>
+  static eT value(eT d2) { return (d2 < 1) ? 1 - d2 : 0; }
+};
+
+struct BiweightKernel
+{
+  static constexpr bool compact = true;
+
+  template <typename eT>
+  static eT value(eT d2) { return (d2 < 1) ? (1 - d2) * (1 - d2) : 0; }
+};
+
+struct TriweightKernel
+{
+  static constexpr bool compact = true;
+
+  template <typename eT>
+  static eT value(eT d2) { return (d2 < 1) ? (1 - d2) * (1 - d2) * (1 - d2) : 0; }
+};
+
+// the weight (1 - d2^2)^3 of the original EpanKernelDist, kept for its callers
+struct EpanLegacyKernel
+{
+  static constexpr bool compact = true;
+
+  template <typename eT>
+  static eT value(eT d2) { return (d2 < 1) ? (1 - d2 * d2) * (1 - d2 * d2) * (1 - d2 * d2) : 0; }
+};
+
+// call f with the functor of the selected kernel, the one branch per call site
+// instantiates f's body once for every kernel
+template <typename F>
+decltype(auto) kernelDispatch(kernel_type type, F &&f)
+{
+  switch (type)
+  {
+  case KERNEL_EPANECHNIKOV:
+    return f(EpanechnikovKernel());
+  case KERNEL_BIWEIGHT:
+    return f(BiweightKernel());
+  case KERNEL_TRIWEIGHT:
+    return f(TriweightKernel());
+  case KERNEL_LAPLACE:
+    return f(LaplaceKernel());
+  case KERNEL_EPAN_LEGACY:
+    return f(EpanLegacyKernel());
+  default:
+    return f(GaussianKernel());
+  }
+}
+
+#endif
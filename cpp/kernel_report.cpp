@@ -0,0 +1,119 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+#include "kernel_ifgt.h"
+#include "kernel_binned.h"
+#include "kernel_nystrom.h"
+#include "kernel_rff.h"
+
+py::dict KernelReport(const arma::mat &X, const arma::mat &B, double bw, int ncore,
+                      const kernel_opts &opts)
+{
+  const kernel_opts kopt = kernelResolve(opts, X.n_rows, B.n_cols);
+
+  py::dict report;
+  report["backend"] = kopt.backend;
+
+  if (!kernelApprox(kopt))
+    return report;
+
+  int N = X.n_rows;
+  int ndr = B.n_cols;
+
+  arma::mat BX = X * B;
+
+  arma::rowvec BX_scale = stddev(BX, 0, 0) * bw * sqrt(2.0);
+
+  for (int j = 0; j < ndr; j++)
+    BX.col(j) /= BX_scale(j);
+
+  // relative error of the kernel mass on evenly spaced rows
+  arma::vec Kx = KernelProd(BX, arma::ones(N), ncore, 1, kopt);
+
+  int m = imin(N, 200);
+  arma::uvec rows = arma::conv_to<arma::uvec>::from(arma::floor(arma::linspace(0, N - 1, m)));
+
+  // exact columns of the sampled rows only
+  arma::vec exact = sum(KernelCols(BX, rows, ncore, 1, kernel_opts(), false), 0).t();
+  arma::vec err = abs(Kx.elem(rows) - exact) / exact;
+
+  report["sampled_rows"] = m;
+  report["max_rel_error"] = err.max();
+  report["mean_rel_error"] = mean(err);
+
+  if (kernelIfgt(kopt))
+  {
+    GaussTransform gauss(BX, kopt.tol, ncore);
+    report["fallback_exact"] = !gauss.usable();
+    report["clusters"] = gauss.n_clusters();
+    report["order"] = gauss.order();
+  }
+
+  if (kernelBinned(kopt))
+  {
+    BinnedKernel binned(BX, kopt.tol, kopt.grid);
+    report["fallback_exact"] = !binned.usable();
+
+    py::list grid;
+    for (arma::uword d = 0; d < binned.grid_size().n_elem; d++)
+      grid.append((int)binned.grid_size()(d));
+    report["grid"] = grid;
+  }
+
+  if (kernelNystrom(kopt))
+  {
+    NystromKernel nystrom(BX, kopt.landmarks, kopt.landmark, kopt.seed, kopt.tol, ncore);
+    report["landmarks"] = nystrom.n_landmarks();
+    report["rank"] = nystrom.rank();
+    report["approx_error"] = nystrom.approx_error(BX, ncore);
+  }
+
+  if (kernelRff(kopt))
+    report["features"] = FourierKernel(ndr, kopt.features, kopt.seed).n_features();
+
+  return report;
+}
+
+//' @title kernel_prod
+//' @name kernel_prod
+//' @description The kernel product K R on points already scaled, with the backend selected in kernel_opts
+//' @keywords internal
+//' @param X The scaled points, N x ndr
+//' @param R The right hand sides, N x q
+//' @param diag The diagonal of K
+//' @param ncore Number of cores, 0 for all
+//' @param kopt Kernel options, see \code{kernel_opts}
+// [[Rcpp::export]]
+arma::mat kernel_prod_info(const arma::mat &X, const arma::mat &R, double diag, int ncore, const kernel_opts &kopt)
+{
+  checkCores(ncore, 0);
+  checkKernel(kopt);
+
+  if (R.n_rows != X.n_rows)
+    throw std::runtime_error("R must have one row per point of X.");
+
+  return KernelProd(X, R, ncore, diag, kopt);
+}
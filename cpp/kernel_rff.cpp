@@ -0,0 +1,86 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <random>
+#include <armadillo>
+#include "utilities.h"
+#include "kernel_rff.h"
+#include "thread_pool.h"
+
+FourierKernel::FourierKernel(int ndr, int features, int seed)
+{
+  int D = (features > 0) ? features : 512;
+
+  std::mt19937 gen(seed);
+  std::normal_distribution<double> normal(0, sqrt(2.0));
+  std::uniform_real_distribution<double> uniform(0, 2 * arma::datum::pi);
+
+  W.set_size(ndr, D);
+  b.set_size(D);
+
+  for (int d = 0; d < D; d++)
+  {
+    for (int k = 0; k < ndr; k++)
+      W(k, d) = normal(gen);
+
+    b(d) = uniform(gen);
+  }
+}
+
+arma::mat FourierKernel::features(const arma::mat &X, int i0, int n) const
+{
+  arma::mat Z = X.rows(i0, i0 + n - 1) * W;
+  Z.each_row() += b;
+
+  return sqrt(2.0 / W.n_cols) * cos(Z);
+}
+
+arma::mat FourierKernel::prod(const arma::mat &X, const arma::mat &R, int ncore, double diag) const
+{
+  int N = X.n_rows;
+  int q = R.n_cols;
+  int D = W.n_cols;
+  int T = 1024;
+  int nb = (N + T - 1) / T;
+
+  // Z' R over blocks of rows, added up in a fixed order for any ncore
+  arma::mat ZR = parallelSum(nb, reduce_chunks, ncore, arma::mat(D, q, arma::fill::zeros),
+                             [&](int c, arma::mat &acc) {
+    int i0 = c * T;
+    int n = imin(T, N - i0);
+    acc += features(X, i0, n).t() * R.rows(i0, i0 + n - 1);
+  });
+
+  arma::mat KR(N, q);
+
+  parallelFor(nb, ncore, [&](int c, int) {
+    int i0 = c * T;
+    int n = imin(T, N - i0);
+    arma::mat Z = features(X, i0, n);
+
+    // replace z(x)' z(x) by the exact diagonal
+    KR.rows(i0, i0 + n - 1) = Z * ZR + R.rows(i0, i0 + n - 1).each_col() % (diag - sum(square(Z), 1));
+  });
+
+  return KR;
+}
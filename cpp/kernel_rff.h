@@ -0,0 +1,53 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <armadillo>
+
+#ifndef orthoDr_kernel_rff
+#define orthoDr_kernel_rff
+
+// Random Fourier features for the gaussian kernel exp(-|x - y|^2):
+//   z(x) = sqrt(2 / D) cos(W' x + b),  W ~ N(0, 2 I),  b ~ U(0, 2 pi),
+// so that K ~ Z Z'. W and b are drawn from the seed, and the features are
+// recomputed from the current points, one chunk of rows at a time, so the
+// N x D feature matrix is never stored. The diagonal is exact.
+
+class FourierKernel
+{
+public:
+  FourierKernel(int ndr, int features, int seed);
+
+  // K * R, R is N x q, in two passes over row chunks: Z' R, then Z (Z' R)
+  arma::mat prod(const arma::mat &X, const arma::mat &R, int ncore, double diag) const;
+
+  int n_features() const { return W.n_cols; }
+
+private:
+  arma::mat W;
+  arma::rowvec b;
+
+  // features of the rows [i0, i0 + n)
+  arma::mat features(const arma::mat &X, int i0, int n) const;
+};
+
+#endif
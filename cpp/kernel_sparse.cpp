@@ -0,0 +1,191 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <vector>
+#include <algorithm>
+#include <armadillo>
+#include "utilities.h"
+#include "thread_pool.h"
+#include "kernel.h"
+#include "kernel_sparse.h"
+#include "kernel_tree.h"
+
+SparseKernel::SparseKernel(const arma::mat &X, int ncore, double diag, kernel_type type)
+{
+  kernelDispatch(type, [&](auto kern) { this->build<decltype(kern)>(X, ncore, diag); });
+}
+
+template <typename Kern>
+void SparseKernel::build(const arma::mat &X, int ncore, double diag)
+{
+  N = X.n_rows;
+  int ndr = X.n_cols;
+
+  // the support has radius 1 in the scaled units, a range query on the k-d tree
+  // returns the ball around each point in ascending column order
+  const KdTree tree(X);
+  const arma::mat Xt = X.t();
+  std::vector<std::vector<arma::uword>> nbr(N);
+  std::vector<std::vector<double>> w(N);
+
+  parallelFor(N, ncore, [&](int i, int) {
+    arma::uvec idx;
+    arma::vec g;
+    tree.range(i, 1, 0, idx, g, diag);
+
+    const double *xi = Xt.colptr(i);
+    nbr[i].reserve(idx.n_elem);
+    w[i].reserve(idx.n_elem);
+
+    for (arma::uword p = 0; p < idx.n_elem; p++)
+    {
+      int j = idx(p);
+
+      if (j == i)
+      {
+        nbr[i].push_back(j);
+        w[i].push_back(diag);
+        continue;
+      }
+
+      // the tree returns gaussian values, the compact kernel needs the distance
+      const double *xj = Xt.colptr(j);
+      double d2 = 0;
+
+      for (int k = 0; k < ndr; k++)
+        d2 += (xi[k] - xj[k]) * (xi[k] - xj[k]);
+
+      if (d2 < 1)
+      {
+        nbr[i].push_back(j);
+        w[i].push_back(Kern::value(d2));
+      }
+    }
+  });
+
+  row_ptr.set_size(N + 1);
+  row_ptr(0) = 0;
+  for (int i = 0; i < N; i++)
+    row_ptr(i + 1) = row_ptr(i) + nbr[i].size();
+
+  col_idx.set_size(row_ptr(N));
+  val.set_size(row_ptr(N));
+
+  parallelFor(N, ncore, [&](int i, int) {
+    std::copy(nbr[i].begin(), nbr[i].end(), col_idx.begin() + row_ptr(i));
+    std::copy(w[i].begin(), w[i].end(), val.begin() + row_ptr(i));
+  });
+}
+
+arma::mat SparseKernel::mult(const arma::mat &R, int ncore) const
+{
+  // work on R' so that every neighbor contributes one contiguous column
+  const arma::mat Rt = R.t();
+  arma::mat KRt(R.n_cols, N);
+
+  parallelFor(N, ncore, [&](int i, int) {
+    arma::vec acc(R.n_cols, arma::fill::zeros);
+
+    for (arma::uword p = row_ptr(i); p < row_ptr(i + 1); p++)
+      acc += val(p) * Rt.col(col_idx(p));
+
+    KRt.col(i) = acc;
+  });
+
+  return KRt.t();
+}
+
+void SparseKernel::row(int i, int from, arma::uvec &idx, arma::vec &w) const
+{
+  const arma::uword *first = col_idx.memptr() + row_ptr(i);
+  const arma::uword *last = col_idx.memptr() + row_ptr(i + 1);
+  arma::uword start = std::lower_bound(first, last, (arma::uword)from) - col_idx.memptr();
+
+  if (start == row_ptr(i + 1))
+  {
+    idx.reset();
+    w.reset();
+    return;
+  }
+
+  idx = col_idx.subvec(start, row_ptr(i + 1) - 1);
+  w = val.subvec(start, row_ptr(i + 1) - 1);
+}
+
+KernelRows::KernelRows(const arma::mat &X, int ncore, double diag, const kernel_opts &opts)
+    : X(X), diag(diag), type(kernelType(opts)), r2(0)
+{
+  const kernel_opts kopt = kernelResolve(opts, X.n_rows, X.n_cols);
+
+  if (kernelCompact(kopt))
+    csr = std::make_shared<SparseKernel>(X, ncore, diag, kernelType(kopt));
+
+  // exp(-d2) < tol outside this radius
+  if (kernelApprox(kopt))
+  {
+    tree = std::make_shared<KdTree>(X);
+    r2 = -log(kopt.tol);
+  }
+}
+
+void KernelRows::row(int i, int from, arma::uvec &idx, arma::vec &w) const
+{
+  if (csr)
+  {
+    csr->row(i, from, idx, w);
+    return;
+  }
+
+  if (tree)
+  {
+    tree->range(i, r2, from, idx, w, diag);
+    return;
+  }
+
+  int N = X.n_rows;
+
+  if (from >= N)
+  {
+    idx.reset();
+    w.reset();
+    return;
+  }
+
+  idx = arma::regspace<arma::uvec>(from, N - 1);
+  w = sum(square(X.rows(from, N - 1).each_row() - X.row(i)), 1);
+
+  kernelDispatch(type, [&](auto kern) { w.transform([](double d2) { return decltype(kern)::value(d2); }); });
+
+  if (i >= from)
+    w(i - from) = diag;
+}
+
+double KernelRows::lookup(const arma::uvec &idx, const arma::vec &w, arma::uword j)
+{
+  const arma::uword *pos = std::lower_bound(idx.begin(), idx.end(), j);
+
+  if (pos == idx.end() || *pos != j)
+    return 0;
+
+  return w(pos - idx.begin());
+}
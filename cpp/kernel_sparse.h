@@ -0,0 +1,59 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <armadillo>
+#include "kernel.h"
+
+#ifndef orthoDr_kernel_sparse
+#define orthoDr_kernel_sparse
+
+// Compact support kernel stored as compressed sparse rows. Neighbors are found
+// by a range query on a k-d tree of the scaled points, so the build costs about
+// O(N log N + N k) for k neighbors in any dimension, and the products and the
+// row access O(N k).
+
+class SparseKernel
+{
+public:
+  SparseKernel(const arma::mat &X, int ncore, double diag, kernel_type type);
+
+  // K * R, R is N x q
+  arma::mat mult(const arma::mat &R, int ncore) const;
+
+  // entries of row i with column index >= from, ascending
+  void row(int i, int from, arma::uvec &idx, arma::vec &w) const;
+
+  arma::uword n_nonzero() const { return col_idx.n_elem; }
+
+private:
+  int N;
+
+  template <typename Kern>
+  void build(const arma::mat &X, int ncore, double diag);
+
+  arma::uvec row_ptr;
+  arma::uvec col_idx;
+  arma::vec val;
+};
+
+#endif
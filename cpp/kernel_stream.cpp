@@ -0,0 +1,596 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+#include <armadillo>
+#include "utilities.h"
+#include "kernel_packed.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "kernel_sparse.h"
+#include "kernel_tree.h"
+#include "kernel_ifgt.h"
+#include "kernel_binned.h"
+#include "kernel_nystrom.h"
+#include "kernel_rff.h"
+
+// fill K(I, J) between the row block I = [i0, i0 + rb) of A and the row block J = [j0, j0 + cb) of B
+
+template <typename eT, typename Kern>
+static void kernel_tile(const arma::Mat<eT> &A, const arma::Col<eT> &sa, const arma::Mat<eT> &B, const arma::Col<eT> &sb,
+                        int i0, int rb, int j0, int cb, arma::Mat<eT> &tile)
+{
+  // squared distances through one small GEMM: |a|^2 + |b|^2 - 2 a'b
+  tile = A.rows(i0, i0 + rb - 1) * B.rows(j0, j0 + cb - 1).t();
+
+  for (int c = 0; c < cb; c++)
+  {
+    eT *t = tile.colptr(c);
+    eT sc = sb(j0 + c);
+
+    for (int r = 0; r < rb; r++)
+      t[r] = Kern::value(std::max(sa(i0 + r) + sc - 2 * t[r], (eT)0));
+  }
+}
+
+// K(A, B) * R, A is the same set as B when self is true and the diagonal is then set to diag
+
+template <typename eT, typename Kern>
+static arma::mat kernel_prod(const arma::Mat<eT> &A, const arma::Mat<eT> &B, const arma::mat &R,
+                             int ncore, bool self, double diag)
+{
+  int NA = A.n_rows;
+  int NB = B.n_rows;
+  int q = R.n_cols;
+  int T = kernel_tile_size();
+  int nbA = (NA + T - 1) / T;
+  int nbB = (NB + T - 1) / T;
+
+  arma::Col<eT> sa = sum(square(A), 1);
+  arma::Col<eT> sb = sum(square(B), 1);
+  arma::mat KR(NA, q);
+
+  // one task per block of rows, with a tile buffer per thread
+  std::vector<arma::Mat<eT>> tiles(ncore);
+
+  parallelFor(nbA, ncore, [&](int bi, int t) {
+    arma::Mat<eT> &tile = tiles[t];
+    int i0 = bi * T;
+    int rb = imin(T, NA - i0);
+    arma::mat acc(rb, q, arma::fill::zeros);
+
+    for (int bj = 0; bj < nbB; bj++)
+    {
+      int j0 = bj * T;
+      int cb = imin(T, NB - j0);
+
+      kernel_tile<eT, Kern>(A, sa, B, sb, i0, rb, j0, cb, tile);
+
+      // the blocks overlap on the diagonal
+      if (self && bi == bj)
+        tile.diag().fill((eT)diag);
+
+      // the tile and its product in the working precision, the sums over tiles in double
+      tileMultAdd(acc, tile, R.rows(j0, j0 + cb - 1));
+    }
+
+    KR.rows(i0, i0 + rb - 1) = acc;
+  });
+
+  return KR;
+}
+
+// the tile K(I, J) restricted to the risk sets, k >= from(i) for the row i of A, which
+// is the point at(i); the exponentials outside the risk set are never evaluated and
+// k = at(i) is set to diag
+
+template <typename eT, typename Kern>
+static void kernel_tile_risk(const arma::Mat<eT> &A, const arma::Col<eT> &sa, const arma::Mat<eT> &B,
+                             const arma::Col<eT> &sb, const arma::uvec &at, const arma::uvec &from, int i0,
+                             int rb, int j0, int cb, double diag, arma::Mat<eT> &tile)
+{
+  tile = A.rows(i0, i0 + rb - 1) * B.rows(j0, j0 + cb - 1).t();
+
+  for (int c = 0; c < cb; c++)
+  {
+    eT *t = tile.colptr(c);
+    eT sc = sb(j0 + c);
+    arma::uword k = j0 + c;
+
+    for (int r = 0; r < rb; r++)
+    {
+      if (k < from(i0 + r))
+        t[r] = 0;
+      else if (k == at(i0 + r))
+        t[r] = (eT)diag;
+      else
+        t[r] = Kern::value(std::max(sa(i0 + r) + sc - 2 * t[r], (eT)0));
+    }
+  }
+}
+
+// risk set sums sum_{k >= from(j)} K(at(j), k) R_k: the points at(j) are gathered into
+// contiguous row tiles, and tiles entirely before the earliest from(j) of a block are skipped
+
+template <typename eT, typename Kern>
+static arma::mat kernel_suffix(const arma::Mat<eT> &X, const arma::mat &R, const arma::uvec &at,
+                               const arma::uvec &from, int ncore, double diag)
+{
+  int N = X.n_rows;
+  int n = at.n_elem;
+  int q = R.n_cols;
+  int T = kernel_tile_size();
+  int nbA = (n + T - 1) / T;
+  int nbB = (N + T - 1) / T;
+
+  arma::Mat<eT> A = X.rows(at);
+  arma::Col<eT> sa = sum(square(A), 1);
+  arma::Col<eT> sb = sum(square(X), 1);
+  arma::mat out(n, q);
+
+  // the blocks differ in cost with the length of their risk sets, which the
+  // stealing of the pool evens out
+  std::vector<arma::Mat<eT>> tiles(ncore);
+
+  parallelFor(nbA, ncore, [&](int bi, int t) {
+    arma::Mat<eT> &tile = tiles[t];
+    int i0 = bi * T;
+    int rb = imin(T, n - i0);
+    int first = from.subvec(i0, i0 + rb - 1).min();
+    arma::mat acc(rb, q, arma::fill::zeros);
+
+    for (int bj = first / T; bj < nbB; bj++)
+    {
+      int j0 = bj * T;
+      int cb = imin(T, N - j0);
+
+      kernel_tile_risk<eT, Kern>(A, sa, X, sb, at, from, i0, rb, j0, cb, diag, tile);
+      tileMultAdd(acc, tile, R.rows(j0, j0 + cb - 1));
+    }
+
+    out.rows(i0, i0 + rb - 1) = acc;
+  });
+
+  return out;
+}
+
+// the N x n block K(, cols), built from tiles of the failure rows and written transposed
+
+template <typename eT, typename Kern>
+static arma::mat kernel_cols(const arma::Mat<eT> &X, const arma::uvec &cols, int ncore, double diag, bool risk)
+{
+  int N = X.n_rows;
+  int n = cols.n_elem;
+  int T = kernel_tile_size();
+  int nbA = (n + T - 1) / T;
+  int nbB = (N + T - 1) / T;
+
+  // without the risk restriction the whole column is kept
+  arma::uvec from = risk ? cols : arma::uvec(n, arma::fill::zeros);
+
+  arma::Mat<eT> A = X.rows(cols);
+  arma::Col<eT> sa = sum(square(A), 1);
+  arma::Col<eT> sb = sum(square(X), 1);
+  arma::mat out(N, n, arma::fill::zeros);
+  std::vector<arma::Mat<eT>> tiles(ncore);
+
+  parallelFor(nbA, ncore, [&](int bi, int t) {
+    arma::Mat<eT> &tile = tiles[t];
+    int i0 = bi * T;
+    int rb = imin(T, n - i0);
+    int first = from.subvec(i0, i0 + rb - 1).min();
+
+    for (int bj = first / T; bj < nbB; bj++)
+    {
+      int j0 = bj * T;
+      int cb = imin(T, N - j0);
+
+      kernel_tile_risk<eT, Kern>(A, sa, X, sb, cols, from, i0, rb, j0, cb, diag, tile);
+      out.submat(j0, i0, j0 + cb - 1, i0 + rb - 1) = arma::conv_to<arma::mat>::from(tile.t());
+    }
+  });
+
+  return out;
+}
+
+arma::mat KernelProd(const arma::mat &X, const arma::mat &R, int ncore, double diag,
+                     const kernel_opts &opts)
+{
+  const kernel_opts kopt = kernelResolve(opts, X.n_rows, X.n_cols);
+
+  // compact support kernels only touch the neighbors
+  if (kernelCompact(kopt))
+    return SparseKernel(X, ncore, diag, kernelType(kopt)).mult(R, ncore);
+
+  // prune far node pairs
+  if (kernelTree(kopt))
+    return KdTree(X).prod(R, kopt.tol, ncore, diag);
+
+  // series expansions around cluster centers in low dimensions
+  if (kernelIfgt(kopt))
+  {
+    GaussTransform gauss(X, kopt.tol, ncore);
+
+    if (gauss.usable())
+      return gauss.prod(R, ncore, diag);
+  }
+
+  // grid convolution in one or two dimensions
+  if (kernelBinned(kopt))
+  {
+    BinnedKernel binned(X, kopt.tol, kopt.grid);
+
+    if (binned.usable())
+      return binned.prod(R, ncore, diag);
+  }
+
+  // low rank factor, two thin products
+  if (kernelNystrom(kopt))
+    return NystromKernel(X, kopt.landmarks, kopt.landmark, kopt.seed, kopt.tol, ncore).prod(R, ncore, diag);
+
+  // random features, streamed over row chunks
+  if (kernelRff(kopt))
+    return FourierKernel(X.n_cols, kopt.features, kopt.seed).prod(X, R, ncore, diag);
+
+  // the kernel is translation invariant, centering keeps |a|^2 + |b|^2 - 2 a'b accurate
+  arma::mat Xc = X.each_row() - mean(X, 0);
+
+  return kernelDispatch(kernelType(kopt), [&](auto kern) -> arma::mat {
+    using Kern = decltype(kern);
+
+    if (kernelSingle(kopt))
+    {
+      arma::fmat Xf = arma::conv_to<arma::fmat>::from(Xc);
+      return kernel_prod<float, Kern>(Xf, Xf, R, ncore, true, diag);
+    }
+
+    return kernel_prod<double, Kern>(Xc, Xc, R, ncore, true, diag);
+  });
+}
+
+arma::mat KernelMoments(const arma::mat &X, const arma::mat &R, arma::rowvec &Kx, int ncore, double diag,
+                        const kernel_opts &kopt)
+{
+  int q = R.n_cols;
+
+  // the row sums come out of the same pass as the last column
+  arma::mat KR = KernelProd(X, join_rows(R, arma::ones(X.n_rows)), ncore, diag, kopt);
+
+  Kx = KR.col(q).t();
+  KR.shed_col(q);
+  KR.each_col() /= Kx.t();
+
+  return KR;
+}
+
+arma::mat KernelLocalGram(const arma::mat &X, const arma::mat &R, arma::mat &KR, int ncore, double diag,
+                          const kernel_opts &kopt)
+{
+  int N = X.n_rows;
+  int d = X.n_cols;
+  int m = d + 1;
+  int q = R.n_cols;
+  int s2 = d * (d + 1) / 2;
+
+  // the normal equations are translation invariant, centering limits the cancellation below
+  arma::mat Xc = X.each_row() - mean(X, 0);
+
+  // right hand sides [1, x, x_k x_l for k <= l, R]
+  arma::mat M(N, 1 + d + s2 + q);
+  M.col(0).ones();
+  M.cols(1, d) = Xc;
+
+  int c = 1 + d;
+  for (int k = 0; k < d; k++)
+    for (int l = k; l < d; l++)
+      M.col(c++) = Xc.col(k) % Xc.col(l);
+
+  if (q > 0)
+    M.cols(c, c + q - 1) = R;
+
+  arma::mat S = KernelProd(Xc, M, ncore, diag, kopt);
+
+  if (q > 0)
+    KR = S.cols(c, c + q - 1);
+  else
+    KR.set_size(N, 0);
+
+  arma::mat gram(N, m * m);
+
+  parallelFor(N, ncore, [&](int i, int) {
+    double S0 = S(i, 0);
+    arma::mat A(m, m);
+
+    A(0, 0) = S0;
+
+    // sum_j K_ij (x_j - x_i)
+    for (int k = 0; k < d; k++)
+      A(0, k + 1) = A(k + 1, 0) = S(i, 1 + k) - S0 * Xc(i, k);
+
+    // sum_j K_ij (x_j - x_i) (x_j - x_i)'
+    int c2 = 1 + d;
+    for (int k = 0; k < d; k++)
+      for (int l = k; l < d; l++)
+      {
+        A(k + 1, l + 1) = A(l + 1, k + 1) = S(i, c2++) - S(i, 1 + k) * Xc(i, l) - Xc(i, k) * S(i, 1 + l) +
+                                            S0 * Xc(i, k) * Xc(i, l);
+      }
+
+    gram.row(i) = vectorise(A).t();
+  });
+
+  return gram;
+}
+
+arma::mat LocalLinearSolve(const arma::mat &gram, const arma::mat &rhs, int ncore)
+{
+  int N = rhs.n_rows;
+  int m = rhs.n_cols;
+
+  arma::mat beta(N, m);
+
+  parallelFor(N, ncore, [&](int i, int) {
+    arma::mat A = reshape(gram.row(i), m, m);
+    arma::mat L;
+
+    // ridge relative to the mean diagonal, grown until the factorization succeeds
+    double scale = dmax(trace(A) / m, 1e-300);
+    double ridge = 0;
+    bool ok = arma::chol(L, A, "lower");
+
+    for (int t = 0; t < 20 && !ok; t++)
+    {
+      ridge = (ridge == 0) ? 1e-10 * scale : 10 * ridge;
+      ok = arma::chol(L, A + ridge * arma::eye(m, m), "lower");
+    }
+
+    if (!ok)
+    {
+      beta.row(i).fill(arma::datum::nan);
+      return;
+    }
+
+    arma::vec z = arma::solve(arma::trimatl(L), rhs.row(i).t());
+    beta.row(i) = arma::solve(arma::trimatu(L.t()), z).t();
+  });
+
+  return beta;
+}
+
+arma::mat KernelRiskSums(const arma::mat &X, const arma::mat &R, const arma::uvec &at, const arma::uvec &from,
+                         int ncore, double diag, const kernel_opts &opts)
+{
+  const kernel_opts kopt = kernelResolve(opts, X.n_rows, X.n_cols);
+  arma::mat R1 = join_rows(R, arma::ones(X.n_rows));
+
+  if (kernelIfgt(kopt))
+  {
+    GaussTransform gauss(X, kopt.tol, ncore);
+
+    if (gauss.usable())
+      return gauss.suffix(R1, at, from, diag);
+  }
+
+  // dense kernels go through masked tiles, parallel over blocks of failures
+  if (!kernelCompact(kopt) && !kernelApprox(kopt))
+  {
+    arma::mat Xc = X.each_row() - mean(X, 0);
+
+    return kernelDispatch(kernelType(kopt), [&](auto kern) -> arma::mat {
+      using Kern = decltype(kern);
+
+      if (kernelSingle(kopt))
+        return kernel_suffix<float, Kern>(arma::conv_to<arma::fmat>::from(Xc), R1, at, from, ncore, diag);
+
+      return kernel_suffix<double, Kern>(Xc, R1, at, from, ncore, diag);
+    });
+  }
+
+  KernelRows kernel_rows(X, ncore, diag, kopt);
+  int n = at.n_elem;
+  arma::mat out(n, R1.n_cols);
+
+  parallelFor(n, ncore, [&](int j, int) {
+    arma::uvec idx;
+    arma::vec w;
+    kernel_rows.row(at(j), from(j), idx, w);
+
+    out.row(j) = w.t() * R1.rows(idx);
+  });
+
+  return out;
+}
+
+arma::mat KernelCols(const arma::mat &X, const arma::uvec &cols, int ncore, double diag, const kernel_opts &opts,
+                     bool risk)
+{
+  const kernel_opts kopt = kernelResolve(opts, X.n_rows, X.n_cols);
+
+  if (!kernelCompact(kopt) && !kernelApprox(kopt))
+  {
+    arma::mat Xc = X.each_row() - mean(X, 0);
+
+    return kernelDispatch(kernelType(kopt), [&](auto kern) -> arma::mat {
+      using Kern = decltype(kern);
+
+      if (kernelSingle(kopt))
+        return kernel_cols<float, Kern>(arma::conv_to<arma::fmat>::from(Xc), cols, ncore, diag, risk);
+
+      return kernel_cols<double, Kern>(Xc, cols, ncore, diag, risk);
+    });
+  }
+
+  // sparse or truncated rows, one column per thread at a time
+  KernelRows kernel_rows(X, ncore, diag, kopt);
+  int n = cols.n_elem;
+  arma::mat out(X.n_rows, n, arma::fill::zeros);
+
+  parallelFor(n, ncore, [&](int j, int) {
+    arma::uvec idx;
+    arma::vec w;
+    kernel_rows.row(cols(j), risk ? cols(j) : 0, idx, w);
+
+    for (arma::uword t = 0; t < idx.n_elem; t++)
+      out(idx(t), j) = w(t);
+  });
+
+  return out;
+}
+
+arma::vec KernelDist_col(const arma::mat &X, int j, double diag)
+{
+  arma::vec k = exp(-sum(square(X.each_row() - X.row(j)), 1));
+  k(j) = diag;
+
+  return k;
+}
+
+// the cross kernel between two point sets already centered at the same point, one
+// pool task per tile
+
+static arma::mat kernel_cross(const arma::mat &A, const arma::vec &sa, const arma::mat &B, const arma::vec &sb,
+                              int ncore)
+{
+  int NA = A.n_rows;
+  int NB = B.n_rows;
+  int T = kernel_tile_size();
+  int nbi = (NA + T - 1) / T;
+  int nbj = (NB + T - 1) / T;
+
+  arma::mat kernel_matrix(NA, NB);
+  std::vector<arma::mat> tiles(ncore);
+
+  parallelFor(nbi * nbj, ncore, [&](int b, int t) {
+    int i0 = (b / nbj) * T;
+    int j0 = (b % nbj) * T;
+    int rb = imin(T, NA - i0);
+    int cb = imin(T, NB - j0);
+
+    kernel_tile<double, GaussianKernel>(A, sa, B, sb, i0, rb, j0, cb, tiles[t]);
+    kernel_matrix.submat(i0, j0, i0 + rb - 1, j0 + cb - 1) = tiles[t];
+  });
+
+  return (kernel_matrix);
+}
+
+//' @title KernelDist_cross
+//' @name KernelDist_cross
+//' @description Calculate the kernel distance between testing data and training data
+//' @keywords internal
+//' @param TestX testing data
+//' @param X training data
+//' @param ncore the number of cores, 0 for all
+// [[Rcpp::export]]
+arma::mat KernelDist_cross(const arma::mat &TestX, const arma::mat &X, int ncore)
+{
+  checkCores(ncore, 0);
+
+  // both sets centered at the training mean keep the GEMM distances accurate
+  arma::rowvec center = mean(X, 0);
+  arma::mat A = TestX.each_row() - center;
+  arma::mat B = X.each_row() - center;
+
+  return kernel_cross(A, sum(square(A), 1), B, sum(square(B), 1), ncore);
+}
+
+//' @title KernelDist_cross_blocks
+//' @name KernelDist_cross_blocks
+//' @description Stream the kernel distance between testing data and training data in row blocks
+//' @keywords internal
+//' @param TestX testing data
+//' @param X training data
+//' @param block the number of testing rows per block, 0 for the tile size
+//' @param callback called as callback(first_row, block) for every block of rows in order
+//' @param ncore the number of cores, 0 for all
+// [[Rcpp::export]]
+void KernelDist_cross_blocks(const arma::mat &TestX, const arma::mat &X, int block, py::function callback, int ncore)
+{
+  checkCores(ncore, 0);
+
+  int TestN = TestX.n_rows;
+
+  if (block <= 0)
+    block = kernel_tile_size();
+
+  // centered once for the whole call, the blocks share the training side
+  arma::rowvec center = mean(X, 0);
+  arma::mat A = TestX.each_row() - center;
+  arma::mat B = X.each_row() - center;
+  arma::vec sa = sum(square(A), 1);
+  arma::vec sb = sum(square(B), 1);
+
+  // only one block of the cross matrix is alive at a time
+  for (int i0 = 0; i0 < TestN; i0 += block)
+  {
+    int rb = imin(block, TestN - i0);
+    arma::mat K_block = kernel_cross(A.rows(i0, i0 + rb - 1), sa.subvec(i0, i0 + rb - 1), B, sb, ncore);
+
+    callback(i0, K_block);
+  }
+}
+
+//' @title KernelDist_cross_predict
+//' @name KernelDist_cross_predict
+//' @description Kernel weighted predictions sum_j K(x, x_j) Y_j / sum_j K(x, x_j) for the testing data
+//' @keywords internal
+//' @param TestX testing data
+//' @param X training data
+//' @param Y training responses, one column per response
+//' @param ncore the number of cores, 0 for all
+// [[Rcpp::export]]
+arma::mat KernelDist_cross_predict(const arma::mat &TestX, const arma::mat &X, const arma::mat &Y, int ncore)
+{
+  checkCores(ncore, 0);
+
+  int q = Y.n_cols;
+
+  arma::rowvec center = mean(X, 0);
+  arma::mat A = TestX.each_row() - center;
+  arma::mat B = X.each_row() - center;
+
+  // the row sums come out of the same pass as the last column
+  arma::mat KY = kernel_prod<double, GaussianKernel>(A, B, join_rows(Y, arma::ones(X.n_rows)), ncore, false, 0);
+
+  arma::vec Kx = KY.col(q);
+  KY.shed_col(q);
+  KY.each_col() /= Kx;
+
+  return KY;
+}
+
+//' @title KernelDist_cross_rowsum
+//' @name KernelDist_cross_rowsum
+//' @description Row sums of the kernel distance between testing data and training data
+//' @keywords internal
+//' @param TestX testing data
+//' @param X training data
+//' @param ncore the number of cores, 0 for all
+// [[Rcpp::export]]
+arma::vec KernelDist_cross_rowsum(const arma::mat &TestX, const arma::mat &X, int ncore)
+{
+  checkCores(ncore, 0);
+
+  arma::rowvec center = mean(X, 0);
+  arma::mat A = TestX.each_row() - center;
+  arma::mat B = X.each_row() - center;
+
+  return kernel_prod<double, GaussianKernel>(A, B, arma::ones(X.n_rows, 1), ncore, false, 0);
+}
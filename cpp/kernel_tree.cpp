@@ -0,0 +1,281 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <vector>
+#include <algorithm>
+#include <armadillo>
+#include "utilities.h"
+#include "thread_pool.h"
+#include "kernel_tree.h"
+
+KdTree::KdTree(const arma::mat &X, int leaf)
+{
+  N = X.n_rows;
+  ndr = X.n_cols;
+  this->leaf = leaf;
+
+  perm = arma::regspace<arma::uvec>(0, N - 1);
+
+  if (N > 0)
+    build(X, 0, N);
+
+  Xs = X.rows(perm).t();
+  pos.set_size(N);
+  pos(perm) = arma::regspace<arma::uvec>(0, N - 1);
+}
+
+int KdTree::build(const arma::mat &X, int begin, int end)
+{
+  int n = nodes.size();
+  nodes.push_back(Node());
+
+  arma::mat Xn = X.rows(perm.subvec(begin, end - 1));
+  arma::vec lo = min(Xn, 0).t();
+  arma::vec hi = max(Xn, 0).t();
+
+  int left = -1;
+  int right = -1;
+
+  if (end - begin > leaf)
+  {
+    // split the widest dimension at the median
+    int dim = index_max(hi - lo);
+    int mid = (begin + end) / 2;
+
+    std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end,
+                     [&](arma::uword a, arma::uword b) { return X(a, dim) < X(b, dim); });
+
+    left = build(X, begin, mid);
+    right = build(X, mid, end);
+  }
+
+  // nodes may have moved while the children were added
+  nodes[n].begin = begin;
+  nodes[n].end = end;
+  nodes[n].left = left;
+  nodes[n].right = right;
+  nodes[n].lo = lo;
+  nodes[n].hi = hi;
+
+  return n;
+}
+
+void KdTree::dual(int qn, int sn, double tol, double diag, const arma::mat &Rt, const arma::mat &Rsum,
+                  arma::mat &out, arma::mat &pending) const
+{
+  const Node &Q = nodes[qn];
+  const Node &S = nodes[sn];
+
+  // bounds on the squared distance between the two boxes
+  double dmin2 = 0;
+  double dmax2 = 0;
+
+  for (int k = 0; k < ndr; k++)
+  {
+    double gap = dmax(dmax(Q.lo(k) - S.hi(k), S.lo(k) - Q.hi(k)), 0);
+    double span = dmax(Q.hi(k) - S.lo(k), S.hi(k) - Q.lo(k));
+    dmin2 += gap * gap;
+    dmax2 += span * span;
+  }
+
+  double kmax = exp(-dmin2);
+  double kmin = exp(-dmax2);
+
+  if (kmax - kmin <= 2 * tol)
+  {
+    pending.col(qn) += 0.5 * (kmax + kmin) * Rsum.col(sn);
+    return;
+  }
+
+  if (is_leaf(qn) && is_leaf(sn))
+  {
+    for (int q = Q.begin; q < Q.end; q++)
+    {
+      const double *xq = Xs.colptr(q);
+
+      for (int s = S.begin; s < S.end; s++)
+      {
+        double k_qs = diag;
+
+        if (q != s)
+        {
+          const double *xs = Xs.colptr(s);
+          double d2 = 0;
+
+          for (int k = 0; k < ndr; k++)
+            d2 += (xq[k] - xs[k]) * (xq[k] - xs[k]);
+
+          k_qs = exp(-d2);
+        }
+
+        out.col(q) += k_qs * Rt.col(s);
+      }
+    }
+    return;
+  }
+
+  // split the larger node
+  if (!is_leaf(qn) && (is_leaf(sn) || Q.end - Q.begin >= S.end - S.begin))
+  {
+    dual(Q.left, sn, tol, diag, Rt, Rsum, out, pending);
+    dual(Q.right, sn, tol, diag, Rt, Rsum, out, pending);
+  }
+  else
+  {
+    dual(qn, S.left, tol, diag, Rt, Rsum, out, pending);
+    dual(qn, S.right, tol, diag, Rt, Rsum, out, pending);
+  }
+}
+
+arma::mat KdTree::prod(const arma::mat &R, double tol, int ncore, double diag) const
+{
+  int q = R.n_cols;
+  int nnode = nodes.size();
+  arma::mat KR(N, q, arma::fill::zeros);
+
+  if (N == 0)
+    return KR;
+
+  const arma::mat Rt = R.rows(perm).t();
+
+  // right hand side sums of every node, children come after their parent
+  arma::mat Rsum(q, nnode);
+  for (int n = nnode - 1; n >= 0; n--)
+  {
+    if (is_leaf(n))
+      Rsum.col(n) = sum(Rt.cols(nodes[n].begin, nodes[n].end - 1), 1);
+    else
+      Rsum.col(n) = Rsum.col(nodes[n].left) + Rsum.col(nodes[n].right);
+  }
+
+  // disjoint query subtrees, one traversal each, so threads never share output;
+  // the frontier does not depend on ncore, and neither do the pairs visited
+  std::vector<int> front(1, 0);
+  while ((int)front.size() < 64)
+  {
+    std::vector<int> next;
+    for (int n : front)
+    {
+      if (is_leaf(n))
+        next.push_back(n);
+      else
+      {
+        next.push_back(nodes[n].left);
+        next.push_back(nodes[n].right);
+      }
+    }
+
+    if (next.size() == front.size())
+      break;
+    front.swap(next);
+  }
+
+  arma::mat out(q, N, arma::fill::zeros);
+  arma::mat pending(q, nnode, arma::fill::zeros);
+  int nfront = front.size();
+
+  parallelFor(nfront, ncore, [&](int f, int) {
+    dual(front[f], 0, tol, diag, Rt, Rsum, out, pending);
+  });
+
+  // push the pruned contributions down to the points
+  for (int n = 0; n < nnode; n++)
+  {
+    if (is_leaf(n))
+      out.cols(nodes[n].begin, nodes[n].end - 1).each_col() += pending.col(n);
+    else
+    {
+      pending.col(nodes[n].left) += pending.col(n);
+      pending.col(nodes[n].right) += pending.col(n);
+    }
+  }
+
+  KR.rows(perm) = out.t();
+
+  return KR;
+}
+
+void KdTree::range(int i, double r2, int from, arma::uvec &idx, arma::vec &w, double diag) const
+{
+  std::vector<arma::uword> found;
+  std::vector<double> val;
+
+  if (N == 0)
+  {
+    idx.reset();
+    w.reset();
+    return;
+  }
+
+  const double *xi = Xs.colptr(pos(i));
+  std::vector<int> stack(1, 0);
+
+  while (!stack.empty())
+  {
+    int n = stack.back();
+    stack.pop_back();
+
+    const Node &node = nodes[n];
+    double dmin2 = 0;
+
+    for (int k = 0; k < ndr; k++)
+    {
+      double gap = dmax(dmax(node.lo(k) - xi[k], xi[k] - node.hi(k)), 0);
+      dmin2 += gap * gap;
+    }
+
+    if (dmin2 > r2)
+      continue;
+
+    if (!is_leaf(n))
+    {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+      continue;
+    }
+
+    for (int s = node.begin; s < node.end; s++)
+    {
+      if ((int)perm(s) < from)
+        continue;
+
+      const double *xs = Xs.colptr(s);
+      double d2 = 0;
+
+      for (int k = 0; k < ndr; k++)
+        d2 += (xi[k] - xs[k]) * (xi[k] - xs[k]);
+
+      if (d2 <= r2)
+      {
+        found.push_back(perm(s));
+        val.push_back((int)perm(s) == i ? diag : exp(-d2));
+      }
+    }
+  }
+
+  arma::uvec order = sort_index(arma::conv_to<arma::uvec>::from(found));
+  idx = arma::conv_to<arma::uvec>::from(found);
+  w = arma::conv_to<arma::vec>::from(val);
+  idx = idx(order);
+  w = w(order);
+}
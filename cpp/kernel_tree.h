@@ -0,0 +1,76 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <vector>
+#include <armadillo>
+
+#ifndef orthoDr_kernel_tree
+#define orthoDr_kernel_tree
+
+// k-d tree over the scaled points for truncated gaussian kernel sums. prod()
+// runs a dual-tree traversal: a pair of nodes whose kernel values can only
+// differ by 2 * tol is replaced by the midpoint value times the node sums, so
+// every kernel entry used is within tol of the exact one. range() returns the
+// kernel row restricted to the ball where the kernel exceeds a cutoff.
+
+class KdTree
+{
+public:
+  KdTree(const arma::mat &X, int leaf = 32);
+
+  // K * R, R is N x q
+  arma::mat prod(const arma::mat &R, double tol, int ncore, double diag) const;
+
+  // entries of row i with squared distance <= r2 and index >= from, ascending
+  void range(int i, double r2, int from, arma::uvec &idx, arma::vec &w, double diag) const;
+
+private:
+  struct Node
+  {
+    int begin;
+    int end;
+    int left;
+    int right;
+    arma::vec lo;
+    arma::vec hi;
+  };
+
+  int N;
+  int ndr;
+  int leaf;
+
+  // points in tree order as columns, perm maps tree position to original row
+  arma::mat Xs;
+  arma::uvec perm;
+  arma::uvec pos;
+  std::vector<Node> nodes;
+
+  int build(const arma::mat &X, int begin, int end);
+
+  void dual(int qn, int sn, double tol, double diag, const arma::mat &Rt, const arma::mat &Rsum,
+            arma::mat &out, arma::mat &pending) const;
+
+  bool is_leaf(int n) const { return nodes[n].left < 0; }
+};
+
+#endif
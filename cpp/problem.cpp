@@ -0,0 +1,124 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+#include "problem.h"
+
+std::shared_ptr<prepared_problem> PrepareProblem(const std::string &method, const arma::mat &X, const arma::mat &Y,
+                                                 int ncore, const kernel_opts &kopt)
+{
+  checkCores(ncore, 0);
+  checkKernel(kopt);
+
+  if (method != "sir" && method != "save" && method != "phd" && method != "seff" && method != "local")
+    throw std::runtime_error("problem method must be one of \"sir\", \"save\", \"phd\", \"seff\", \"local\".");
+
+  if (X.n_rows != Y.n_rows)
+    throw std::runtime_error("X and Y must have the same number of rows.");
+
+  // the precomputed terms (the packed Y kernel of seff) must fit before they are built
+  checkPlan(KernelPlan(method, X.n_rows, X.n_cols, 1, ncore, kopt));
+
+  auto prob = std::make_shared<prepared_problem>();
+  prob->method = method;
+  prob->X = X;
+  prob->Y = Y;
+  prob->kopt = kopt;
+
+  if (method == "sir")
+    sir_prepare(*prob, ncore);
+  else if (method == "save")
+    save_prepare(*prob, ncore);
+  else if (method == "seff")
+    seff_prepare(*prob, ncore);
+
+  return prob;
+}
+
+double ProblemInit(const prepared_problem &prob, const arma::mat &B, double bw, int ncore)
+{
+  if (B.n_rows != prob.X.n_cols)
+    throw std::runtime_error("B must have one row per column of X.");
+
+  if (prob.method == "sir")
+    return sir_init_prepared(B, prob, bw, ncore);
+  if (prob.method == "save")
+    return save_init_prepared(B, prob, bw, ncore);
+  if (prob.method == "phd")
+    return phd_init_prepared(B, prob, bw, ncore);
+  if (prob.method == "seff")
+    return seff_init_prepared(B, prob, bw, ncore);
+
+  return local_init_prepared(B, prob, bw, ncore);
+}
+
+py::dict ProblemSolve(const prepared_problem &prob, arma::mat B, double bw, double rho, double eta, double gamma,
+                      double tau, double epsilon, double btol, double ftol, double gtol, int maxitr, int verbose,
+                      int ncore)
+{
+  if (B.n_rows != prob.X.n_cols)
+    throw std::runtime_error("B must have one row per column of X.");
+
+  if (prob.method == "sir")
+    return sir_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore);
+  if (prob.method == "save")
+    return save_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore);
+  if (prob.method == "phd")
+    return phd_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore);
+  if (prob.method == "seff")
+    return seff_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore);
+
+  return local_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore);
+}
+
+py::dict ProblemSolveMulti(const prepared_problem &prob, py::list starts, double bw, double rho, double eta,
+                           double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                           int maxitr, int verbose, int ncore)
+{
+  // every start reuses the same precalculation, each fit is parallel inside
+  py::list fits;
+  int best = -1;
+  double best_fn = arma::datum::inf;
+
+  for (size_t k = 0; k < starts.size(); k++)
+  {
+    arma::mat B = starts[k].cast<arma::mat>();
+    py::dict fit = ProblemSolve(prob, B, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore);
+
+    double fn = fit["fn"].cast<double>();
+    if (fn < best_fn)
+    {
+      best_fn = fn;
+      best = k;
+    }
+
+    fits.append(fit);
+  }
+
+  py::dict ret;
+  ret["fits"] = fits;
+  ret["best"] = best;
+  return (ret);
+}
@@ -0,0 +1,104 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+#include <string>
+#include <memory>
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+#include "kernel_packed.h"
+
+#ifndef orthoDr_problem
+#define orthoDr_problem
+
+// Prepared regression problem: the data, the kernel options and the B
+// independent precomputation of the method, built once and shared by the init
+// functions, the solvers, multi-start runs and objective evaluations.
+//   sir:   Exy = E[X | Y]
+//   save:  Exy = X - E[X | Y], with Mxy = E[X | Y] and the Y kernel row sums Ky
+//          standing in for I - cov[X | Y], and Uxy with rows E[XX' | Y]_i Exy_i'
+//   phd:   the data only
+//   seff:  the packed gaussian kernel of Y
+//   local: the data only
+
+struct prepared_problem
+{
+  std::string method;
+  arma::mat X;
+  arma::mat Y;
+  kernel_opts kopt;
+
+  arma::mat Exy;
+  arma::mat Mxy;
+  arma::rowvec Ky;
+  arma::mat Uxy;
+  std::shared_ptr<PackedKernel> kernel_y;
+};
+
+std::shared_ptr<prepared_problem> PrepareProblem(const std::string &method, const arma::mat &X, const arma::mat &Y,
+                                                 int ncore, const kernel_opts &kopt);
+
+void sir_prepare(prepared_problem &prob, int ncore);
+void save_prepare(prepared_problem &prob, int ncore);
+
+// coordinates p of X whose products X_p X go through one kernel pass in save
+int saveBlock(int P);
+void seff_prepare(prepared_problem &prob, int ncore);
+
+double sir_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore);
+double save_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore);
+double phd_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore);
+double seff_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore);
+double local_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore);
+
+py::dict sir_solver_prepared(arma::mat B, const prepared_problem &prob, double bw, double rho, double eta,
+                             double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                             int maxitr, int verbose, int ncore);
+
+py::dict save_solver_prepared(arma::mat B, const prepared_problem &prob, double bw, double rho, double eta,
+                              double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                              int maxitr, int verbose, int ncore);
+
+py::dict phd_solver_prepared(arma::mat B, const prepared_problem &prob, double bw, double rho, double eta,
+                             double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                             int maxitr, int verbose, int ncore);
+
+py::dict seff_solver_prepared(arma::mat B, const prepared_problem &prob, double bw, double rho, double eta,
+                              double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                              int maxitr, int verbose, int ncore);
+
+py::dict local_solver_prepared(arma::mat B, const prepared_problem &prob, double bw, double rho, double eta,
+                               double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                               int maxitr, int verbose, int ncore);
+
+// python entry points, dispatching on the method of the problem
+double ProblemInit(const prepared_problem &prob, const arma::mat &B, double bw, int ncore);
+
+py::dict ProblemSolve(const prepared_problem &prob, arma::mat B, double bw, double rho, double eta, double gamma,
+                      double tau, double epsilon, double btol, double ftol, double gtol, int maxitr, int verbose,
+                      int ncore);
+
+py::dict ProblemSolveMulti(const prepared_problem &prob, py::list starts, double bw, double rho, double eta,
+                           double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                           int maxitr, int verbose, int ncore);
+
+#endif
@@ -1,5 +1,8 @@
 #include <armadillo>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "problem.h"
 //[[Rcpp::depends(RcppArmadillo)]]
 
 //' @title local_f
@@ -11,10 +14,10 @@ double local_f(const arma::mat &B,
                const arma::mat &X,
                const arma::mat &Y,
                double bw,
-               int ncore)
+               int ncore,
+               const kernel_opts &kopt)
 {
   int N = X.n_rows;
-  int P = X.n_cols;
   int ndr = B.n_cols;
 
   arma::mat BX = X * B;
@@ -23,62 +26,29 @@ double local_f(const arma::mat &B,
   for (int j = 0; j < ndr; j++)
     BX.col(j) /= BX_scale(j);
 
-  arma::mat kernel_matrix_x(N, N);
+  // only differences of BX enter, centering keeps the moment sums accurate
+  BX.each_row() -= mean(BX, 0);
 
-  if (ncore > 1)
-    kernel_matrix_x = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix_x = KernelDist_single(BX, 1);
-
-  arma::rowvec Kx = sum(kernel_matrix_x, 0);
+  arma::rowvec Kx;
+  arma::mat Ex = KernelMoments(BX, X, Kx, ncore, 1, kopt);
 
-  arma::mat Ex(N, P, arma::fill::zeros);
-
-  for (int i = 0; i < N; i++)
-  {
-    for (int j = 0; j < N; j++)
-    {
-      Ex.row(i) += X.row(j) * kernel_matrix_x(i, j);
-    }
-    Ex.row(i) /= Kx(i);
-  }
+  // local linear fits of Y on BX at every point, the normal equations and the
+  // right hand side sum_j K_ij [1, BX_j - BX_i] Y_j come out of one kernel pass
+  arma::mat KY;
+  arma::mat gram = KernelLocalGram(BX, join_rows(Y.col(0), BX.each_col() % Y.col(0)), KY, ncore, 1, kopt);
 
-  // get half power of kernel weights
-  kernel_matrix_x = sqrt(kernel_matrix_x);
+  arma::mat rhs = KY;
+  rhs.cols(1, ndr) -= BX.each_col() % KY.col(0);
 
-  arma::vec a(N);
-  arma::mat b(N, ndr);
-  arma::mat X_w(N, ndr + 1);
+  arma::mat beta = LocalLinearSolve(gram, rhs, ncore);
 
-  for (int i = 0; i < N; i++)
-  {
-
-    for (int j = 0; j < N; j++)
-      for (int k = 0; k < ndr; k++)
-        X_w(j, k + 1) = BX(j, k) - BX(i, k);
-
-    X_w.col(0) = kernel_matrix_x.col(i);
-
-    for (int k = 1; k < ndr + 1; k++)
-      X_w.col(k) = X_w.col(k) % kernel_matrix_x.col(i);
-
-    //arma::mat beta_hat = (X_w.t()*X_w).i()*(X_w.t()*( Y % kernel_matrix_x.col(i)) );
-
-    arma::mat beta_hat = arma::solve(X_w, Y % kernel_matrix_x.col(i), arma::solve_opts::fast);
-
-    a(i) = beta_hat(0, 0);
-
-    for (int k = 0; k < ndr; k++)
-      b(i, k) = beta_hat(k + 1, 0);
-  }
+  arma::vec a = beta.col(0);
+  arma::mat b = beta.cols(1, ndr);
 
   double ret = 0;
-  arma::mat Seff_sum(P, ndr, arma::fill::zeros);
 
-  for (int i = 0; i < N; i++)
-  {
-    Seff_sum += (X.row(i) - Ex.row(i)).t() * (Y.row(i) - a(i)) * b.row(i);
-  }
+  // sum_i (X_i - Ex_i)' (Y_i - a_i) b_i
+  arma::mat Seff_sum = (X - Ex).t() * (b.each_col() % (Y.col(0) - a));
 
   ret = accu(pow(Seff_sum, 2) / N / N);
 
@@ -92,78 +62,71 @@ void local_g(arma::mat &B,
              const arma::mat &Y,
              double bw,
              double epsilon,
-             int ncore)
+             const kernel_plan &plan)
 {
   int P = B.n_rows;
   int ndr = B.n_cols;
 
-#pragma omp parallel num_threads(ncore)
-  {
-    // create one copy of B for each thread
-    arma::mat NewB(P, ndr);
-    NewB = B;
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
 
-#pragma omp for collapse(2) schedule(static)
-    for (int j = 0; j < ndr; j++)
-    {
-      for (int i = 0; i < P; i++)
-      {
-        // small increment
-        double temp = B(i, j);
-        NewB(i, j) = B(i, j) + epsilon;
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
 
-        // calculate gradiant
-        G(i, j) = (local_f(NewB, X, Y, bw, ncore) - F0) / epsilon;
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
+
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (local_f(NewB[t], X, Y, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
 
-        // reset
-        NewB(i, j) = temp;
-      }
-    }
-  }
   return;
 }
 
-//' @title local semi regression solver \code{C++} function
-//' @name local_solver
-//' @description Sovling the local semiparametric estimating equations. This is an internal function and should not be called directly.
-//' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X A matrix of the parameters \code{X}
-//' @param Y A matrix of the parameters \code{Y}
-//' @param bw Kernel bandwidth for X
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Functional value tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @references Ma, Y., & Zhu, L. (2013). "Efficient estimation in sufficient dimension reduction." Annals of statistics, 41(1), 250.
-//' DOI:10.1214/12-AOS1072 \url{https://projecteuclid.org/euclid.aos/1364302742}
-//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
-//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//'
-// [[Rcpp::export]]
+double local_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore)
+{
+  checkCores(ncore, 0.0);
 
-py::dict local_solver(arma::mat B,
-                      arma::mat &X,
-                      arma::mat &Y,
-                      double bw,
-                      double rho,
-                      double eta,
-                      double gamma,
-                      double tau,
-                      double epsilon,
-                      double btol,
-                      double ftol,
-                      double gtol,
-                      int maxitr,
-                      int verbose,
-                      int ncore)
+  // the threads and options a solver would evaluate the objective with
+  kernel_plan plan = KernelPlan("local", prob.X.n_rows, prob.X.n_cols, B.n_cols, ncore, prob.kopt);
+  checkPlan(plan);
+
+  return local_f(B, prob.X, prob.Y, bw, plan.single, plan.kopt);
+}
+
+// the solver on a prepared problem, see problem.h
+
+py::dict local_solver_prepared(arma::mat B,
+                               const prepared_problem &prob,
+                               double bw,
+                               double rho,
+                               double eta,
+                               double gamma,
+                               double tau,
+                               double epsilon,
+                               double btol,
+                               double ftol,
+                               double gtol,
+                               int maxitr,
+                               int verbose,
+                               int ncore)
 {
+  const arma::mat &X = prob.X;
+  const arma::mat &Y = prob.Y;
+
   // int N = X.n_rows;
   int P = B.n_rows;
   int ndr = B.n_cols;
@@ -182,13 +145,19 @@ py::dict local_solver(arma::mat B,
 
   checkCores(ncore, verbose);
 
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("local", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
+
   //Initial function value and gradient, prepare for iterations
 
-  double F = local_f(B, X, Y, bw, ncore);
+  double F = local_f(B, X, Y, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  local_g(B, F, G, X, Y, bw, epsilon, ncore);
+  local_g(B, F, G, X, Y, bw, epsilon, plan);
 
   //return G
 
@@ -261,8 +230,8 @@ py::dict local_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = local_f(B, X, Y, bw, ncore);
-      local_g(B, F, G, X, Y, bw, epsilon, ncore);
+      F = local_f(B, X, Y, bw, plan.single, kopt);
+      local_g(B, F, G, X, Y, bw, epsilon, plan);
 
       if ((F <= (Cval - tau * deriv)) || (nls >= 5))
       {
@@ -358,5 +327,57 @@ py::dict local_solver(arma::mat B,
   ret["fn"] = F;
   ret["itr"] = itr;
   ret["converge"] = (itr < maxitr);
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
   return (ret);
 }
+
+//' @title local semi regression solver \code{C++} function
+//' @name local_solver
+//' @description Sovling the local semiparametric estimating equations. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X A matrix of the parameters \code{X}
+//' @param Y A matrix of the parameters \code{Y}
+//' @param bw Kernel bandwidth for X
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Functional value tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @references Ma, Y., & Zhu, L. (2013). "Efficient estimation in sufficient dimension reduction." Annals of statistics, 41(1), 250.
+//' DOI:10.1214/12-AOS1072 \url{https://projecteuclid.org/euclid.aos/1364302742}
+//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
+//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//'
+// [[Rcpp::export]]
+
+py::dict local_solver(arma::mat B,
+                      arma::mat &X,
+                      arma::mat &Y,
+                      double bw,
+                      double rho,
+                      double eta,
+                      double gamma,
+                      double tau,
+                      double epsilon,
+                      double btol,
+                      double ftol,
+                      double gtol,
+                      int maxitr,
+                      int verbose,
+                      int ncore,
+                      const kernel_opts &kopt)
+{
+  checkCores(ncore, verbose);
+
+  return local_solver_prepared(B, *PrepareProblem("local", X, Y, ncore, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                               ftol, gtol, maxitr, verbose, ncore);
+}
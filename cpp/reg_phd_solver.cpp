@@ -1,20 +1,22 @@
 #include <armadillo>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "problem.h"
 
 //[[Rcpp::depends(RcppArmadillo)]]
 
 double phd_f(const arma::mat &B,
              const arma::mat &X,
              const arma::mat &Y,
-             const arma::cube &XX,
              double bw,
-             int ncore)
+             int ncore,
+             const kernel_opts &kopt)
 {
   // This function computes the estimation equations and its 2-norm for the semi-parametric dimensional reduction model
   // OptCpp1(B, G, X, Phit_cpp, inRisk, kernel.bw.scale, Fail.Ind)
 
   int N = X.n_rows;
-  int P = X.n_cols;
   int ndr = B.n_cols;
 
   arma::mat BX = X * B;
@@ -28,43 +30,17 @@ double phd_f(const arma::mat &B,
 
   //std::cout << "Start" << std::endl;
 
-  arma::mat kernel_matrix_x(N, N);
+  // E[Y | BX] and the residual r = Y - E[Y | BX]
+  arma::rowvec Kx;
+  arma::vec r = Y.col(0) - KernelMoments(BX, Y.col(0), Kx, ncore, 1, kopt);
 
-  if (ncore > 1)
-    kernel_matrix_x = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix_x = KernelDist_single(BX, 1);
-
-  arma::rowvec Kx = sum(kernel_matrix_x, 0);
-
-  // XX - E[XX | BX]
+  // sum_i (X_i X_i' - E[XX' | BX]_i) r_i = X' diag(r) X - X' diag(K (r / Kx)) X,
+  // the kernel is symmetric so the second weight is one more kernel product
+  arma::vec w = r - KernelProd(BX, r / Kx.t(), ncore, 1, kopt);
 
-  arma::cube XX_BX(P, P, N, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < N; i++)
-  {
-
-    double EY_BX = 0;
-
-    for (int j = 0; j < N; j++)
-    {
-      XX_BX.slice(i) += X.row(j).t() * X.row(j) * kernel_matrix_x(i, j);
-      EY_BX += Y(j) * kernel_matrix_x(i, j);
-    }
+  // one weighted Gram matrix
+  arma::mat Est = X.t() * (X.each_col() % w);
 
-    XX_BX.slice(i) = (XX.slice(i) - XX_BX.slice(i) / Kx(i)) * (Y(i) - EY_BX / Kx(i));
-  }
-
-  //std::cout << Ex << std::endl;
-
-  arma::mat Est(P, P, arma::fill::zeros);
-
-  for (int i = 0; i < N; i++)
-  {
-    Est += XX_BX.slice(i);
-  }
-  //stop("Top here ...");
   return accu(pow(Est, 2)) / N / N;
 }
 
@@ -73,40 +49,59 @@ void phd_g(arma::mat &B,
            arma::mat &G,
            const arma::mat &X,
            const arma::mat &Y,
-           const arma::cube &XX,
            double bw,
            double epsilon,
-           int ncore)
+           const kernel_plan &plan)
 {
   int P = B.n_rows;
   int ndr = B.n_cols;
 
-#pragma omp parallel num_threads(ncore)
-  {
-    // create one copy of B for each thread
-    arma::mat NewB(P, ndr);
-    NewB = B;
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
 
-#pragma omp for collapse(2) schedule(static)
-    for (int j = 0; j < ndr; j++)
-      for (int i = 0; i < P; i++)
-      { // small increment
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
 
-        double temp = B(i, j);
-        NewB(i, j) = B(i, j) + epsilon;
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
 
-        // calculate gradiant
-        G(i, j) = (phd_f(NewB, X, Y, XX, bw, 1) - F0) / epsilon;
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (phd_f(NewB[t], X, Y, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
 
-        // reset
-        NewB(i, j) = temp;
-      }
-  }
   return;
 }
 
 // initial value
 
+double phd_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore)
+{
+  checkCores(ncore, 0.0);
+
+  // the threads and options a solver would evaluate the objective with
+  kernel_plan plan = KernelPlan("phd", prob.X.n_rows, prob.X.n_cols, B.n_cols, ncore, prob.kopt);
+  checkPlan(plan);
+
+  // Initial function value
+
+  double F = phd_f(B, prob.X, prob.Y, bw, plan.single, plan.kopt);
+
+  return F;
+}
+
 //' @title phd_init
 //' @name phd_init
 //' @description phd initial value function
@@ -117,71 +112,34 @@ double phd_init(const arma::mat &B,
                 const arma::mat &X,
                 const arma::mat &Y,
                 double bw,
-                int ncore)
+                int ncore,
+                const kernel_opts &kopt)
 {
-  int N = X.n_rows;
-  int P = B.n_rows;
-
   checkCores(ncore, 0.0);
 
-  //precalculate
-
-  arma::cube XX(P, P, N, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < N; i++)
-  {
-    XX.slice(i) = X.row(i).t() * X.row(i);
-  }
-
-  // Initial function value
-
-  double F = phd_f(B, X, Y, XX, bw, ncore);
-
-  return F;
+  return phd_init_prepared(B, *PrepareProblem("phd", X, Y, ncore, kopt), bw, ncore);
 }
 
-//' @title semi-phd solver \code{C++} function
-//' @name phd_solver
-//' @description Sovling the semi-phd estimating equations. This is an internal function and should not be called directly.
-//' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X A matrix of the parameters \code{X}
-//' @param Y A matrix of the parameters \code{Y}
-//' @param bw Kernel bandwidth for X
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Functional value tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @references Ma, Y., & Zhu, L. (2012). A semiparametric approach to dimension reduction. Journal of the American Statistical Association, 107(497), 168-179.
-//' DOI: \url{https://dx.doi.org/10.1214\%2F12-AOS1072SUPP}.
-//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
-//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//'
-// [[Rcpp::export]]
-
-py::dict phd_solver(arma::mat B,
-                    arma::mat &X,
-                    arma::mat &Y,
-                    double bw,
-                    double rho,
-                    double eta,
-                    double gamma,
-                    double tau,
-                    double epsilon,
-                    double btol,
-                    double ftol,
-                    double gtol,
-                    int maxitr,
-                    int verbose,
-                    int ncore)
+// the solver on a prepared problem, see problem.h
+
+py::dict phd_solver_prepared(arma::mat B,
+                             const prepared_problem &prob,
+                             double bw,
+                             double rho,
+                             double eta,
+                             double gamma,
+                             double tau,
+                             double epsilon,
+                             double btol,
+                             double ftol,
+                             double gtol,
+                             int maxitr,
+                             int verbose,
+                             int ncore)
 {
+  const arma::mat &X = prob.X;
+  const arma::mat &Y = prob.Y;
+
   int N = X.n_rows;
   int P = B.n_rows;
   int ndr = B.n_cols;
@@ -200,23 +158,19 @@ py::dict phd_solver(arma::mat B,
 
   checkCores(ncore, verbose);
 
-  //precalculate
-
-  arma::cube XX(P, P, N, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < N; i++)
-  {
-    XX.slice(i) = X.row(i).t() * X.row(i);
-  }
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("phd", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
 
   // Initial function value and gradient, prepare for iterations
 
-  double F = phd_f(B, X, Y, XX, bw, ncore);
+  double F = phd_f(B, X, Y, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  phd_g(B, F, G, X, Y, XX, bw, epsilon, ncore);
+  phd_g(B, F, G, X, Y, bw, epsilon, plan);
 
   //return G;
 
@@ -289,8 +243,8 @@ py::dict phd_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = phd_f(B, X, Y, XX, bw, ncore);
-      phd_g(B, F, G, X, Y, XX, bw, epsilon, ncore);
+      F = phd_f(B, X, Y, bw, plan.single, kopt);
+      phd_g(B, F, G, X, Y, bw, epsilon, plan);
 
       if ((F <= (Cval - tau * deriv)) || (nls >= 5))
       {
@@ -386,5 +340,57 @@ py::dict phd_solver(arma::mat B,
   ret["fn"] = F;
   ret["itr"] = itr;
   ret["converge"] = (itr < maxitr);
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
   return (ret);
 }
+
+//' @title semi-phd solver \code{C++} function
+//' @name phd_solver
+//' @description Sovling the semi-phd estimating equations. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X A matrix of the parameters \code{X}
+//' @param Y A matrix of the parameters \code{Y}
+//' @param bw Kernel bandwidth for X
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Functional value tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @references Ma, Y., & Zhu, L. (2012). A semiparametric approach to dimension reduction. Journal of the American Statistical Association, 107(497), 168-179.
+//' DOI: \url{https://dx.doi.org/10.1214\%2F12-AOS1072SUPP}.
+//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
+//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//'
+// [[Rcpp::export]]
+
+py::dict phd_solver(arma::mat B,
+                    arma::mat &X,
+                    arma::mat &Y,
+                    double bw,
+                    double rho,
+                    double eta,
+                    double gamma,
+                    double tau,
+                    double epsilon,
+                    double btol,
+                    double ftol,
+                    double gtol,
+                    int maxitr,
+                    int verbose,
+                    int ncore,
+                    const kernel_opts &kopt)
+{
+  checkCores(ncore, verbose);
+
+  return phd_solver_prepared(B, *PrepareProblem("phd", X, Y, ncore, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                             ftol, gtol, maxitr, verbose, ncore);
+}
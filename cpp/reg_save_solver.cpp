@@ -1,15 +1,39 @@
 #include <armadillo>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "problem.h"
 
 //[[Rcpp::depends(RcppArmadillo)]]
 
+// right hand sides X_p X for the coordinates p0, ..., p0 + g - 1, one N x P block each
+
+static arma::mat save_products(const arma::mat& X, int p0, int g)
+{
+  int P = X.n_cols;
+  arma::mat XX(X.n_rows, g * P);
+
+  for (int p = 0; p < g; p++)
+    XX.cols(p * P, p * P + P - 1) = X.each_col() % X.col(p0 + p);
+
+  return XX;
+}
+
+int saveBlock(int P)
+{
+  return imax(1, imin(P, 64 / P));
+}
+
 double save_f(const arma::mat& B,
               const arma::mat& X,
               const arma::mat& Y,
               const arma::mat& Exy,
-              const arma::cube& Covxy,
+              const arma::mat& Mxy,
+              const arma::rowvec& Ky,
+              const arma::mat& Uxy,
               double bw,
-              int ncore)
+              int ncore,
+              const kernel_opts& kopt)
 {
   // This function computes the estimation equations and its 2-norm for the semi-parametric dimensional reduction model
   // OptCpp1(B, G, X, Phit_cpp, inRisk, kernel.bw.scale, Fail.Ind)
@@ -25,79 +49,56 @@ double save_f(const arma::mat& B,
   for (int j=0; j<ndr; j++)
     BX.col(j) /= BX_scale(j);
 
- // std::cout << stddev(BX, 0, 0) << std::endl;
-
-  //std::cout << "Start" << std::endl;
-
-  arma::mat kernel_matrix_x(N, N);
-
-  if (ncore > 1)
-    kernel_matrix_x = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix_x = KernelDist_single(BX, 1);
-
-  arma::rowvec Kx = sum(kernel_matrix_x, 0);
-
-  //std::cout << "After Kx" << std::endl;
-
   // E[X | BX]
 
-  arma::mat Ex(N,P, arma::fill::zeros);
+  arma::rowvec Kx;
+  arma::mat Ex = KernelMoments(BX, X, Kx, ncore, 1, kopt);
+  arma::mat Rx = X - Ex;
 
-// #pragma omp parallel for schedule(static) num_threads(ncore)
-  for(int i=0; i<N; i++){
-    for(int j=0; j<N; j++){
-      Ex.row(i) += X.row(j)*kernel_matrix_x(i,j);
-    }
-    Ex.row(i) /= Kx(i);
-    // Ex.row(i) = X.row(i) - Ex.row(i);
-  }
-
-  // arma::rowvec EEx = sum(Ex, 0);
+  // Est = sum_i (I + Mxy_i' Mxy_i - E[XX' | Y]_i) (Exy_i' Rx_i - E[XX' | BX]_i + Ex_i' Ex_i).
+  // The second moments only enter through Z_p = E[X_p X | BX] for each coordinate p:
+  //   sum_i E[XX' | BX]_i               has rows sum_i Z_p,i
+  //   sum_i Mxy_i' Mxy_i E[XX' | BX]_i  = Mxy' sum_p Mxy_p Z_p
+  //   sum_i E[XX' | Y]_i E[XX' | BX]_i  = sum_p (X_p X)' Ky (Z_p / Ky)
+  // and likewise for Ex_i' Ex_i, so X_p X, Z_p and the Y kernel product are
+  // formed for a few p at a time and nothing of size N x P^2 is kept.
 
-  // cov[X | XB]
+  arma::mat Sx(P, P);
+  arma::mat Q(N, P, arma::fill::zeros);
+  arma::mat T(P, P, arma::fill::zeros);
 
-  arma::cube Covxx(P, P, N, arma::fill::zeros);
+  int g = saveBlock(P);
 
-// #pragma omp parallel for schedule(static) num_threads(ncore)
-  for(int i=0; i<N; i++){
-    for(int j=0; j<N; j++){
-      Covxx.slice(i) += (X.row(j).t() * X.row(j))*kernel_matrix_x(i,j);
-    }
-    Covxx.slice(i) /= Kx(i);
-    Covxx.slice(i) -= Ex.row(i).t() * Ex.row(i);
-    Ex.row(i) = X.row(i) - Ex.row(i);
-  }
-
-  //std::cout << Ex << std::endl;
+  for (int p0 = 0; p0 < P; p0 += g)
+  {
+    int gb = imin(g, P - p0);
+    arma::mat XX = save_products(X, p0, gb);
 
-  arma::mat Est(P, P, arma::fill::zeros);
+    arma::mat Z = KernelProd(BX, XX, ncore, 1, kopt);
+    Z.each_col() /= Kx.t();
 
-  for (int i=0; i < N; i++){
-    Est += Covxy.slice(i) * (Exy.row(i).t()*Ex.row(i) - Covxx.slice(i));
+    arma::mat W(N, gb * P);
 
-    //std::cout << Covxy.slice(i) * (Exy.row(i).t()*Ex.row(i) - Covxx.slice(i)) << std::endl;
-  }
-
-/*
-  arma::cube EE(P, P, N, arma::fill::zeros);
+    for (int p = 0; p < gb; p++)
+    {
+      const arma::mat Z_p(Z.colptr(p * P), N, P, false, true);
 
-  // #pragma omp parallel for schedule(static) num_threads(ncore)
-  for(int i=0; i<N; i++){
-    for(int j=0; j<N; j++){
-      EE.slice(i) += (X.row(j).t() * X.row(j))*kernel_matrix_x(i,j);
+      Sx.row(p0 + p) = sum(Z_p, 0);
+      Q += Z_p.each_col() % Mxy.col(p0 + p);
+      W.cols(p * P, p * P + P - 1) = (Ex.each_col() % Ex.col(p0 + p) - Z_p).each_col() / Ky.t();
     }
-    EE.slice(i) /= Kx(i);
 
-    EE.slice(i) = (X.row(i).t() * X.row(i) - EE.slice(i));
+    W = KernelProd(Y, W, ncore, 1, kernelGaussian(kopt));
+
+    for (int p = 0; p < gb; p++)
+      T += XX.cols(p * P, p * P + P - 1).t() * W.cols(p * P, p * P + P - 1);
   }
 
-  arma::mat Est(P, P, arma::fill::zeros);
+  arma::vec s_e = sum(Mxy % Exy, 1);
+  arma::vec s_x = sum(Mxy % Ex, 1);
 
-  for (int i=0; i < N; i++){
-    Est += EE.slice(i);
-  }
-*/
+  arma::mat Est = (Exy - Uxy + Mxy.each_col() % s_e).t() * Rx + (Ex + Mxy.each_col() % s_x).t() * Ex - Sx -
+                  Mxy.t() * Q - T;
 
   return accu(pow(Est/N, 2));
 
@@ -109,140 +110,133 @@ void save_g(arma::mat& B,
             const arma::mat& X,
             const arma::mat& Y,
             const arma::mat& Exy,
-            const arma::cube& Covxy,
+            const arma::mat& Mxy,
+            const arma::rowvec& Ky,
+            const arma::mat& Uxy,
             double bw,
             double epsilon,
-            int ncore)
+            const kernel_plan &plan)
   {
   int P = B.n_rows;
   int ndr = B.n_cols;
 
-#pragma omp parallel num_threads(ncore)
-{
-  // create one copy of B for each thread
-  arma::mat NewB(P, ndr);
-  NewB = B;
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
 
-  #pragma omp for collapse(2) schedule(static)
-  for (int j = 0; j < ndr; j++)
-    for (int i = 0; i < P; i++)
-    {  // small increment
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
 
-      double temp = B(i, j);
-      NewB(i, j) = B(i, j) + epsilon;
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
 
-      // calculate gradiant
-      G(i,j) = (save_f(NewB, X, Y, Exy, Covxy, bw, 1) - F0) / epsilon;
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (save_f(NewB[t], X, Y, Exy, Mxy, Ky, Uxy, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
 
-      // reset
-      NewB(i, j) = temp;
-    }
-}
   return;
 }
 
 // initial value
 
-//' @title save_init
-//' @name save_init
-//' @description save initial value function
-//' @keywords internal
-// [[Rcpp::export]]
-double save_init(const arma::mat& B,
-                 const arma::mat& X,
-                 const arma::mat& Y,
-                 double bw,
-                 int ncore)
+// B independent precalculation, see problem.h
+
+void save_prepare(prepared_problem &prob, int ncore)
 {
+  const arma::mat &X = prob.X;
   int N = X.n_rows;
-  int P = B.n_rows;
-
-  // initialize parallel computing
-
-  checkCores(ncore, 0.0);
-
-  //precalculate
-
-  arma::mat kernel_matrix_y = KernelDist_multi(Y, ncore, 1);
+  int P = X.n_cols;
 
-  arma::rowvec Ky = sum(kernel_matrix_y, 0);
+  // E[X | Y], I - cov[X | Y] is kept factored through it and the Y kernel
+  prob.Mxy = KernelMoments(prob.Y, X, prob.Ky, ncore, 1, kernelGaussian(prob.kopt));
 
   // X - E[X | Y]
-  arma::mat Exy(N, P, arma::fill::zeros);
+  prob.Exy = X - prob.Mxy;
 
-  // I - cov[X | Y]
-  arma::cube Covxy(P, P, N, arma::fill::zeros);
-  arma::mat diag = arma::eye(P, P);
+  // E[XX' | Y]_i Exy_i' = sum_p Exy_i,p E[X_p X | Y]_i, a few p at a time
+  prob.Uxy.zeros(N, P);
 
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for(int i=0; i<N; i++){
-    for(int j=0; j<N; j++){
-      Exy.row(i) += X.row(j)*kernel_matrix_y(i,j);
-      Covxy.slice(i) += (X.row(j).t() * X.row(j)) * kernel_matrix_y(i,j);
-    }
+  int g = saveBlock(P);
 
-    // E[X | Y]
-    Exy.row(i) /= Ky(i);
+  for (int p0 = 0; p0 < P; p0 += g)
+  {
+    int gb = imin(g, P - p0);
+    arma::mat Z = KernelProd(prob.Y, save_products(X, p0, gb), ncore, 1, kernelGaussian(prob.kopt));
+    Z.each_col() /= prob.Ky.t();
 
-    // E[XX | Y]
-    Covxy.slice(i) /= Ky(i);
+    for (int p = 0; p < gb; p++)
+      prob.Uxy += Z.cols(p * P, p * P + P - 1).each_col() % prob.Exy.col(p0 + p);
+  }
+}
 
-    // I - cov[X | Y]
-    Covxy.slice(i) = diag - Covxy.slice(i) + Exy.row(i).t()*Exy.row(i);
+double save_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore)
+{
+  checkCores(ncore, 0.0);
 
-    // X - E[X | Y]
-    Exy.row(i) = X.row(i) - Exy.row(i);
-  }
+  // the threads and options a solver would evaluate the objective with
+  kernel_plan plan = KernelPlan("save", prob.X.n_rows, prob.X.n_cols, B.n_cols, ncore, prob.kopt);
+  checkPlan(plan);
 
   // Initial function value
 
-  double F = save_f(B, X, Y, Exy, Covxy, bw, ncore);
+  double F = save_f(B, prob.X, prob.Y, prob.Exy, prob.Mxy, prob.Ky, prob.Uxy, bw, plan.single, plan.kopt);
 
   return F;
 }
 
-
-//' @title semi-save solver \code{C++} function
-//' @name save_solver
-//' @description Sovling the semi-save estimating equations. This is an internal function and should not be called directly.
+//' @title save_init
+//' @name save_init
+//' @description save initial value function
 //' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X A matrix of the parameters \code{X}
-//' @param Y A matrix of the parameters \code{Y}
-//' @param bw Kernel bandwidth for X
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Functional value tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @references Ma, Y. & Zhu, L. (2012). A semiparametric approach to dimension reduction. Journal of the American Statistical Association, 107(497), 168-179.
-//' DOI: \url{https://dx.doi.org/10.1214\%2F12-AOS1072SUPP}.
-//' @references Wen, Z. & Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
-//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//'
 // [[Rcpp::export]]
-
-py::dict save_solver(arma::mat B,
-                 arma::mat& X,
-                 arma::mat& Y,
+double save_init(const arma::mat& B,
+                 const arma::mat& X,
+                 const arma::mat& Y,
                  double bw,
-                 double rho,
-                 double eta,
-                 double gamma,
-                 double tau,
-                 double epsilon,
-                 double btol,
-                 double ftol,
-                 double gtol,
-                 int maxitr,
-                 int verbose,
-                 int ncore)
+                 int ncore,
+                 const kernel_opts& kopt)
 {
+  checkCores(ncore, 0.0);
+
+  return save_init_prepared(B, *PrepareProblem("save", X, Y, ncore, kopt), bw, ncore);
+}
+
+// the solver on a prepared problem, see problem.h
+
+py::dict save_solver_prepared(arma::mat B,
+                              const prepared_problem &prob,
+                              double bw,
+                              double rho,
+                              double eta,
+                              double gamma,
+                              double tau,
+                              double epsilon,
+                              double btol,
+                              double ftol,
+                              double gtol,
+                              int maxitr,
+                              int verbose,
+                              int ncore)
+{
+  const arma::mat &X = prob.X;
+  const arma::mat &Y = prob.Y;
+  const arma::mat &Exy = prob.Exy;
+  const arma::mat &Mxy = prob.Mxy;
+  const arma::rowvec &Ky = prob.Ky;
+  const arma::mat &Uxy = prob.Uxy;
+
   int N = X.n_rows;
   int P = B.n_rows;
   int ndr = B.n_cols;
@@ -260,46 +254,19 @@ py::dict save_solver(arma::mat B,
 
   checkCores(ncore, verbose);
 
-  //precalculate
-
-  arma::mat kernel_matrix_y = KernelDist_multi(Y, ncore, 1);
-
-  arma::rowvec Ky = sum(kernel_matrix_y, 0);
-
-  // X - E[X | Y]
-  arma::mat Exy(N, P, arma::fill::zeros);
-
-  // I - cov[X | Y]
-  arma::cube Covxy(P, P, N, arma::fill::zeros);
-  arma::mat diag = arma::eye(P, P);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for(int i=0; i<N; i++){
-    for(int j=0; j<N; j++){
-      Exy.row(i) += X.row(j)*kernel_matrix_y(i,j);
-      Covxy.slice(i) += (X.row(j).t() * X.row(j)) * kernel_matrix_y(i,j);
-    }
-
-    // E[X | Y]
-    Exy.row(i) /= Ky(i);
-
-    // E[XX | Y]
-    Covxy.slice(i) /= Ky(i);
-
-    // I - cov[X | Y]
-    Covxy.slice(i) = diag - Covxy.slice(i) + Exy.row(i).t()*Exy.row(i);
-
-    // X - E[X | Y]
-    Exy.row(i) = X.row(i) - Exy.row(i);
-  }
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("save", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
 
   // Initial function value and gradient, prepare for iterations
 
-  double F = save_f(B, X, Y, Exy, Covxy, bw, ncore);
+  double F = save_f(B, X, Y, Exy, Mxy, Ky, Uxy, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  save_g(B, F, G, X, Y, Exy, Covxy, bw, epsilon, ncore);
+  save_g(B, F, G, X, Y, Exy, Mxy, Ky, Uxy, bw, epsilon, plan);
 
   //return G;
 
@@ -364,8 +331,8 @@ py::dict save_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = save_f(B, X, Y, Exy, Covxy, bw, ncore);
-      save_g(B, F, G, X, Y, Exy, Covxy, bw, epsilon, ncore);
+      F = save_f(B, X, Y, Exy, Mxy, Ky, Uxy, bw, plan.single, kopt);
+      save_g(B, F, G, X, Y, Exy, Mxy, Ky, Uxy, bw, epsilon, plan);
 
       if((F <= (Cval - tau*deriv)) || (nls >= 5)){
         break;
@@ -452,5 +419,57 @@ py::dict save_solver(arma::mat B,
   ret["fn"] = F;
   ret["itr"] = itr;
   ret["converge"] = (itr<maxitr);
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
   return (ret);
 }
+
+//' @title semi-save solver \code{C++} function
+//' @name save_solver
+//' @description Sovling the semi-save estimating equations. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X A matrix of the parameters \code{X}
+//' @param Y A matrix of the parameters \code{Y}
+//' @param bw Kernel bandwidth for X
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Functional value tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @references Ma, Y. & Zhu, L. (2012). A semiparametric approach to dimension reduction. Journal of the American Statistical Association, 107(497), 168-179.
+//' DOI: \url{https://dx.doi.org/10.1214\%2F12-AOS1072SUPP}.
+//' @references Wen, Z. & Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
+//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//'
+// [[Rcpp::export]]
+
+py::dict save_solver(arma::mat B,
+                 arma::mat& X,
+                 arma::mat& Y,
+                 double bw,
+                 double rho,
+                 double eta,
+                 double gamma,
+                 double tau,
+                 double epsilon,
+                 double btol,
+                 double ftol,
+                 double gtol,
+                 int maxitr,
+                 int verbose,
+                 int ncore,
+                 const kernel_opts& kopt)
+{
+  checkCores(ncore, verbose);
+
+  return save_solver_prepared(B, *PrepareProblem("save", X, Y, ncore, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                              ftol, gtol, maxitr, verbose, ncore);
+}
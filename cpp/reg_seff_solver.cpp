@@ -1,5 +1,9 @@
 #include <armadillo>
 #include "utilities.h"
+#include "kernel_packed.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "problem.h"
 
 
 //[[Rcpp::depends(RcppArmadillo)]]
@@ -7,12 +11,12 @@
 double seff_f(const arma::mat& B,
               const arma::mat& X,
               const arma::mat& Y,
-              const arma::mat& kernel_matrix_y,
+              const PackedKernel& kernel_matrix_y,
               double bw,
-              int ncore)
+              int ncore,
+              const kernel_opts& kopt)
 {
   int N = X.n_rows;
-  int P = X.n_cols;
   int ndr = B.n_cols;
 
   arma::mat BX = X * B;
@@ -21,57 +25,42 @@ double seff_f(const arma::mat& B,
   for (int j=0; j<ndr; j++)
     BX.col(j) /= BX_scale(j);
 
-  arma::mat kernel_matrix_x(N, N);
+  // only differences of BX enter, centering keeps the moment sums accurate
+  BX.each_row() -= mean(BX, 0);
 
-  if (ncore > 1)
-    kernel_matrix_x = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix_x = KernelDist_single(BX, 1);
+  arma::rowvec Kx;
+  arma::mat Ex = KernelMoments(BX, X, Kx, ncore, 1, kopt);
 
-  arma::rowvec Kx = sum(kernel_matrix_x, 0);
+  // normal equations of the local linear fits at every point
+  arma::mat KR;
+  arma::mat gram = KernelLocalGram(BX, arma::mat(N, 0), KR, ncore, 1, kopt);
 
-  arma::mat Ex(N, P, arma::fill::zeros);
+  // right hand sides sum_j Kx_ij Ky_ij [1, BX_j - BX_i], over the support of row i
+  KernelRows kernel_x(BX, ncore, 1, kopt);
+  arma::mat rhs(N, ndr + 1);
 
-  for(int i=0; i<N; i++){
-    for(int j=0; j<N; j++){
-      Ex.row(i) += X.row(j)*kernel_matrix_x(i,j);
-    }
-    Ex.row(i) /= Kx(i);
-  }
-
-  // get half power of kernel weights
-  kernel_matrix_x = sqrt(kernel_matrix_x);
-
-  arma::vec a(N);
-  arma::mat b(N,ndr);
-  arma::mat X_w(N, ndr + 1);
+  // support and weight buffers per thread
+  std::vector<arma::uvec> idx(ncore);
+  std::vector<arma::vec> w(ncore);
 
-  for(int i=0; i<N; i++){
+  parallelFor(N, ncore, [&](int i, int t) {
+    arma::vec &w_i = w[t];
 
-    for(int j=0; j<N; j++)
-      for (int k=0; k<ndr; k++)
-        X_w(j, k+1) = BX(j, k) - BX(i, k);
+    kernel_x.row(i, 0, idx[t], w_i);
+    w_i %= kernel_matrix_y.col(i).elem(idx[t]);
 
-    X_w.col(0) = kernel_matrix_x.col(i);
+    rhs(i, 0) = sum(w_i);
+    rhs.row(i).cols(1, ndr) = w_i.t() * BX.rows(idx[t]) - rhs(i, 0) * BX.row(i);
+  });
 
-    for (int k=1; k<ndr+1; k++)
-      X_w.col(k) = X_w.col(k) % kernel_matrix_x.col(i);
+  arma::mat beta = LocalLinearSolve(gram, rhs, ncore);
 
-    arma::mat beta_hat = (X_w.t()*X_w).i()*(X_w.t()*( kernel_matrix_y.col(i) % kernel_matrix_x.col(i)) );
-
-    a(i) = beta_hat(0,0);
-
-    for(int k=0; k<ndr; k++)
-      b(i,k) = beta_hat(k+1, 0);
-
-  }
+  arma::vec a = beta.col(0);
+  arma::mat b = beta.cols(1, ndr);
 
   double ret = 0;
-  arma::mat Seff_sum(P, ndr, arma::fill::zeros);
+  arma::mat Seff_sum = (X - Ex).t() * (b.each_col() / a);
 
-  for(int i=0; i<N; i++){
-    Seff_sum += (X.row(i)-Ex.row(i)).t()*b.row(i)/a(i);
-  }
   ret = accu(pow(Seff_sum/N, 2));
 
   return ret;
@@ -82,116 +71,107 @@ void seff_g(arma::mat& B,
             arma::mat& G,
             const arma::mat& X,
             const arma::mat& Y,
-            const arma::mat& kernel_matrix_y,
+            const PackedKernel& kernel_matrix_y,
             double bw,
             double epsilon,
-            int ncore)
+            const kernel_plan &plan)
 {
   int P = B.n_rows;
   int ndr = B.n_cols;
 
 
-#pragma omp parallel num_threads(ncore)
-{
-  // create one copy of B for each thread
-  arma::mat NewB(P, ndr);
-  NewB = B;
-
-  #pragma omp for collapse(2) schedule(static)
-  for (int j = 0; j < ndr; j++)
-  {
-    for (int i = 0; i < P; i++)
-    {
-      // small increment
-      double temp = B(i, j);
-      NewB(i, j) = B(i, j) + epsilon;
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
 
-      // calculate gradiant
-      G(i,j) = (seff_f(NewB, X, Y, kernel_matrix_y, bw, ncore) - F0) / epsilon;
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
+
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
+
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (seff_f(NewB[t], X, Y, kernel_matrix_y, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
 
-      // reset
-      NewB(i, j) = temp;
-    }
-  }
-}
   return;
 }
 
 
 // initial value
-//' @title seff_init
-//' @name seff_init
-//' @description semiparametric efficient method initial value function
-//' @keywords internal
-// [[Rcpp::export]]
+// B independent precalculation, see problem.h
 
-double seff_init(const arma::mat& B,
-                const arma::mat& X,
-                const arma::mat& Y,
-                double bw,
-                int ncore)
+void seff_prepare(prepared_problem &prob, int ncore)
 {
-  int N = X.n_rows;
-
-  // initialize parallel computing
+  prob.kernel_y = std::make_shared<PackedKernel>(prob.Y, ncore, 1, kernelSingle(prob.kopt));
+}
 
+double seff_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore)
+{
   checkCores(ncore, 0.0);
 
-  //precalculate
-  arma::mat kernel_matrix_y(N,N);
-
-  kernel_matrix_y = KernelDist_multi(Y, ncore, 1);
+  // the threads and options a solver would evaluate the objective with
+  kernel_plan plan = KernelPlan("seff", prob.X.n_rows, prob.X.n_cols, B.n_cols, ncore, prob.kopt);
+  checkPlan(plan);
 
-  //Initial function value
+  // Initial function value
 
-  double F = seff_f(B, X, Y, kernel_matrix_y, bw, ncore);
+  double F = seff_f(B, prob.X, prob.Y, *prob.kernel_y, bw, plan.single, plan.kopt);
 
   return F;
 }
 
-
-//' @title Eff semi regression solver \code{C++} function
-//' @name seff_solver
-//' @description Sovling the semiparametric efficient estimating equations. This is an internal function and should not be called directly.
+//' @title seff_init
+//' @name seff_init
+//' @description semiparametric efficient method initial value function
 //' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X A matrix of the parameters \code{X}
-//' @param Y A matrix of the parameters \code{Y}
-//' @param bw Kernel bandwidth for X
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Functional value tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @references Ma, Y., & Zhu, L. (2013). "Efficient estimation in sufficient dimension reduction." Annals of statistics, 41(1), 250.
-//' DOI:10.1214/12-AOS1072 \url{https://projecteuclid.org/euclid.aos/1364302742}
-//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
-//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//'
 // [[Rcpp::export]]
 
-py::dict seff_solver(arma::mat B,
-                arma::mat& X,
-                arma::mat& Y,
+double seff_init(const arma::mat& B,
+                const arma::mat& X,
+                const arma::mat& Y,
                 double bw,
-                double rho,
-                double eta,
-                double gamma,
-                double tau,
-                double epsilon,
-                double btol,
-                double ftol,
-                double gtol,
-                int maxitr,
-                int verbose,
-                int ncore)
+                int ncore,
+                const kernel_opts& kopt)
 {
-  int N = X.n_rows;
+  checkCores(ncore, 0.0);
+
+  return seff_init_prepared(B, *PrepareProblem("seff", X, Y, ncore, kopt), bw, ncore);
+}
+
+// the solver on a prepared problem, see problem.h
+
+py::dict seff_solver_prepared(arma::mat B,
+                              const prepared_problem &prob,
+                              double bw,
+                              double rho,
+                              double eta,
+                              double gamma,
+                              double tau,
+                              double epsilon,
+                              double btol,
+                              double ftol,
+                              double gtol,
+                              int maxitr,
+                              int verbose,
+                              int ncore)
+{
+  const arma::mat &X = prob.X;
+  const arma::mat &Y = prob.Y;
+  const PackedKernel &kernel_matrix_y = *prob.kernel_y;
+
   int P = B.n_rows;
   int ndr = B.n_cols;
 
@@ -208,18 +188,19 @@ py::dict seff_solver(arma::mat B,
 
   checkCores(ncore, verbose);
 
-  //precalculate
-  arma::mat kernel_matrix_y(N,N);
-
-  kernel_matrix_y = KernelDist_multi(Y, ncore, 1);
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("seff", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
 
   //Initial function value and gradient, prepare for iterations
 
-  double F = seff_f(B, X, Y, kernel_matrix_y, bw, ncore);
+  double F = seff_f(B, X, Y, kernel_matrix_y, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  seff_g(B, F, G, X, Y, kernel_matrix_y, bw, epsilon, ncore);
+  seff_g(B, F, G, X, Y, kernel_matrix_y, bw, epsilon, plan);
 
   //return G
 
@@ -284,8 +265,8 @@ py::dict seff_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = seff_f(B, X, Y, kernel_matrix_y, bw, ncore);
-      seff_g(B, F, G, X, Y, kernel_matrix_y, bw, epsilon, ncore);
+      F = seff_f(B, X, Y, kernel_matrix_y, bw, plan.single, kopt);
+      seff_g(B, F, G, X, Y, kernel_matrix_y, bw, epsilon, plan);
 
 
       if((F <= (Cval - tau*deriv)) || (nls >= 5)){
@@ -373,5 +354,57 @@ py::dict seff_solver(arma::mat B,
   ret["fn"] = F;
   ret["itr"] = itr;
   ret["converge"] = (itr<maxitr);
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
   return (ret);
 }
+
+//' @title Eff semi regression solver \code{C++} function
+//' @name seff_solver
+//' @description Sovling the semiparametric efficient estimating equations. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X A matrix of the parameters \code{X}
+//' @param Y A matrix of the parameters \code{Y}
+//' @param bw Kernel bandwidth for X
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Functional value tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @references Ma, Y., & Zhu, L. (2013). "Efficient estimation in sufficient dimension reduction." Annals of statistics, 41(1), 250.
+//' DOI:10.1214/12-AOS1072 \url{https://projecteuclid.org/euclid.aos/1364302742}
+//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
+//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//'
+// [[Rcpp::export]]
+
+py::dict seff_solver(arma::mat B,
+                arma::mat& X,
+                arma::mat& Y,
+                double bw,
+                double rho,
+                double eta,
+                double gamma,
+                double tau,
+                double epsilon,
+                double btol,
+                double ftol,
+                double gtol,
+                int maxitr,
+                int verbose,
+                int ncore,
+                const kernel_opts& kopt)
+{
+  checkCores(ncore, verbose);
+
+  return seff_solver_prepared(B, *PrepareProblem("seff", X, Y, ncore, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                              ftol, gtol, maxitr, verbose, ncore);
+}
@@ -1,5 +1,8 @@
 #include <armadillo>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "problem.h"
 
 //[[Rcpp::depends(RcppArmadillo)]]
 
@@ -7,7 +10,8 @@ double sir_f(const arma::mat &B,
              const arma::mat &X,
              const arma::mat &Exy,
              double bw,
-             int ncore)
+             int ncore,
+             const kernel_opts &kopt)
 {
   // This function computes the estimation equations and its 2-norm for the semi-parametric dimensional reduction model
   // OptCpp1(B, G, X, Phit_cpp, inRisk, kernel.bw.scale, Fail.Ind)
@@ -25,38 +29,19 @@ double sir_f(const arma::mat &B,
 
   //std::cout << "Start" << std::endl;
 
-  arma::mat kernel_matrix_x;
+  // E[X | BX] and E[E[X | Y] | BX] in one streaming pass over the kernel
+  arma::rowvec Kx;
+  arma::mat Exx = KernelMoments(BX, join_rows(X, Exy), Kx, ncore, 1, kopt);
 
-  if (ncore > 1)
-    kernel_matrix_x = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix_x = KernelDist_single(BX, 1);
-
-  arma::rowvec Kx = sum(kernel_matrix_x, 0);
-
-  arma::mat Ex(N, P, arma::fill::zeros);
-  arma::mat Exyx(N, P, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < N; i++)
-  {
-    for (int j = 0; j < N; j++)
-    {
-      Ex.row(i) += X.row(j) * kernel_matrix_x(i, j);
-      Exyx.row(i) += Exy.row(j) * kernel_matrix_x(i, j);
-    }
-    Ex.row(i) /= Kx(i);
-    Exyx.row(i) /= Kx(i);
-  }
-
-  arma::mat Est(P, P, arma::fill::zeros);
+  // the residuals overwrite the moments in place
+  arma::mat R2 = X - Exx.cols(0, P - 1);
+  Exx.shed_cols(0, P - 1);
+  Exx = Exy - Exx;
 
-  for (int i = 0; i < N; i++)
-  {
-    Est += (Exy.row(i) - Exyx.row(i)).t() * (X.row(i) - Ex.row(i));
-  }
+  // sum_i (Exy_i - Exyx_i)' (X_i - Ex_i) as one GEMM
+  arma::mat Est = Exx.t() * R2;
 
-  return accu(pow(Est, 2)) / N / N;
+  return accu(square(Est)) / N / N;
 }
 
 void sir_g(arma::mat &B,
@@ -66,118 +51,103 @@ void sir_g(arma::mat &B,
            const arma::mat &Exy,
            double bw,
            double epsilon,
-           int ncore)
+           const kernel_plan &plan)
 {
   int P = B.n_rows;
   int ndr = B.n_cols;
 
-#pragma omp parallel num_threads(ncore)
-  {
-    // create one copy of B for each thread
-    arma::mat NewB(P, ndr);
-    NewB = B;
-
-#pragma omp for collapse(2) schedule(static)
-    for (int j = 0; j < ndr; j++)
-      for (int i = 0; i < P; i++)
-      { // small increment
-        double temp = B(i, j);
-        NewB(i, j) = B(i, j) + epsilon;
-
-        // calculate gradiant
-        G(i, j) = (sir_f(NewB, X, Exy, bw, 1) - F0) / epsilon;
-
-        // reset
-        NewB(i, j) = temp;
-      }
-  }
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
+
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
+
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
+
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (sir_f(NewB[t], X, Exy, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
+
   return;
 }
 
 // initial function
 
-//' @title sir_init
-//' @name sir_init
-//' @description sir initial value function
-//' @keywords internal
-// [[Rcpp::export]]
-double sir_init(const arma::mat &B,
-                const arma::mat &X,
-                const arma::mat &Y,
-                double bw,
-                int ncore)
+// B independent precalculation, see problem.h
+
+void sir_prepare(prepared_problem &prob, int ncore)
 {
-  int N = X.n_rows;
-  int P = B.n_rows;
+  // E[X | Y]
+  arma::rowvec Ky;
+  prob.Exy = KernelMoments(prob.Y, prob.X, Ky, ncore, 1, kernelGaussian(prob.kopt));
+}
 
+double sir_init_prepared(const arma::mat &B, const prepared_problem &prob, double bw, int ncore)
+{
   checkCores(ncore, 0.0);
 
-  //precalculate
-
-  arma::mat kernel_matrix_y = KernelDist_multi(Y, ncore, 1);
-
-  arma::rowvec Ky = sum(kernel_matrix_y, 0);
-  arma::mat Exy(N, P, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < N; i++)
-  {
-    for (int j = 0; j < N; j++)
-    {
-      Exy.row(i) += X.row(j) * kernel_matrix_y(i, j);
-    }
-    Exy.row(i) /= Ky(i);
-  }
+  // the threads and options a solver would evaluate the objective with
+  kernel_plan plan = KernelPlan("sir", prob.X.n_rows, prob.X.n_cols, B.n_cols, ncore, prob.kopt);
+  checkPlan(plan);
 
   // Initial function value
 
-  double F = sir_f(B, X, Exy, bw, ncore);
+  double F = sir_f(B, prob.X, prob.Exy, bw, plan.single, plan.kopt);
 
   return F;
 }
 
-//' @title semi-sir solver \code{C++} function
-//' @name sir_solver
-//' @description Sovling the semi-sir estimating equations. This is an internal function and should not be called directly.
+//' @title sir_init
+//' @name sir_init
+//' @description sir initial value function
 //' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X A matrix of the parameters \code{X}
-//' @param Y A matrix of the parameters \code{Y}
-//' @param bw Kernel bandwidth for X
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Functional value tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @references Ma, Y., & Zhu, L. (2012). A semiparametric approach to dimension reduction. Journal of the American Statistical Association, 107(497), 168-179.
-//' DOI: \url{https://dx.doi.org/10.1214\%2F12-AOS1072SUPP}.
-//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
-//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//'
 // [[Rcpp::export]]
-
-py::dict sir_solver(arma::mat B,
-                arma::mat &X,
-                arma::mat &Y,
+double sir_init(const arma::mat &B,
+                const arma::mat &X,
+                const arma::mat &Y,
                 double bw,
-                double rho,
-                double eta,
-                double gamma,
-                double tau,
-                double epsilon,
-                double btol,
-                double ftol,
-                double gtol,
-                int maxitr,
-                int verbose,
-                int ncore)
+                int ncore,
+                const kernel_opts &kopt)
 {
-  int N = X.n_rows;
+  checkCores(ncore, 0.0);
+
+  return sir_init_prepared(B, *PrepareProblem("sir", X, Y, ncore, kopt), bw, ncore);
+}
+
+// the solver on a prepared problem, see problem.h
+
+py::dict sir_solver_prepared(arma::mat B,
+                             const prepared_problem &prob,
+                             double bw,
+                             double rho,
+                             double eta,
+                             double gamma,
+                             double tau,
+                             double epsilon,
+                             double btol,
+                             double ftol,
+                             double gtol,
+                             int maxitr,
+                             int verbose,
+                             int ncore)
+{
+  const arma::mat &X = prob.X;
+  const arma::mat &Exy = prob.Exy;
+
   int P = B.n_rows;
   int ndr = B.n_cols;
 
@@ -195,30 +165,19 @@ py::dict sir_solver(arma::mat B,
 
   checkCores(ncore, verbose);
 
-  //precalculate
-
-  arma::mat kernel_matrix_y = KernelDist_multi(Y, ncore, 1);
-
-  arma::rowvec Ky = sum(kernel_matrix_y, 0);
-  arma::mat Exy(N, P, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < N; i++)
-  {
-    for (int j = 0; j < N; j++)
-    {
-      Exy.row(i) += X.row(j) * kernel_matrix_y(i, j);
-    }
-    Exy.row(i) /= Ky(i);
-  }
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("sir", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
 
   // Initial function value and gradient, prepare for iterations
 
-  double F = sir_f(B, X, Exy, bw, ncore);
+  double F = sir_f(B, X, Exy, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  sir_g(B, F, G, X, Exy, bw, epsilon, ncore);
+  sir_g(B, F, G, X, Exy, bw, epsilon, plan);
 
   //return G;
 
@@ -291,8 +250,8 @@ py::dict sir_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = sir_f(B, X, Exy, bw, ncore);
-      sir_g(B, F, G, X, Exy, bw, epsilon, ncore);
+      F = sir_f(B, X, Exy, bw, plan.single, kopt);
+      sir_g(B, F, G, X, Exy, bw, epsilon, plan);
 
       if ((F <= (Cval - tau * deriv)) || (nls >= 5))
       {
@@ -388,5 +347,57 @@ py::dict sir_solver(arma::mat B,
   ret["fn"] = F;
   ret["itr"] = itr;
   ret["converge"] = (itr < maxitr);
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
   return (ret);
 }
+
+//' @title semi-sir solver \code{C++} function
+//' @name sir_solver
+//' @description Sovling the semi-sir estimating equations. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X A matrix of the parameters \code{X}
+//' @param Y A matrix of the parameters \code{Y}
+//' @param bw Kernel bandwidth for X
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for apprximating numerical gradient, if \code{g} is not given.
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Functional value tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @references Ma, Y., & Zhu, L. (2012). A semiparametric approach to dimension reduction. Journal of the American Statistical Association, 107(497), 168-179.
+//' DOI: \url{https://dx.doi.org/10.1214\%2F12-AOS1072SUPP}.
+//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434.
+//' DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//'
+// [[Rcpp::export]]
+
+py::dict sir_solver(arma::mat B,
+                arma::mat &X,
+                arma::mat &Y,
+                double bw,
+                double rho,
+                double eta,
+                double gamma,
+                double tau,
+                double epsilon,
+                double btol,
+                double ftol,
+                double gtol,
+                int maxitr,
+                int verbose,
+                int ncore,
+                const kernel_opts &kopt)
+{
+  checkCores(ncore, verbose);
+
+  return sir_solver_prepared(B, *PrepareProblem("sir", X, Y, ncore, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                             ftol, gtol, maxitr, verbose, ncore);
+}
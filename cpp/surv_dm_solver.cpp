@@ -20,23 +20,34 @@
 //
 //    ----------------------------------------------------------------
 
+#include <vector>
 #include <armadillo>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "surv_problem.h"
 
 // [[Rcpp::depends(RcppArmadillo)]]
 
 double surv_dm_f(const arma::mat &B,
                  const arma::mat &X,
                  const arma::mat &Phit,
-                 const arma::vec &Fail_Ind,
+                 const arma::uvec &fail_ind,
+                 const arma::uvec &risk_ind,
+                 const arma::uvec &tie_group,
                  double bw,
-                 int ncore)
+                 int ncore,
+                 const kernel_opts &kopt)
 {
   int N = X.n_rows;
   int P = X.n_cols;
-  int nFail = Fail_Ind.size();
+  int nFail = fail_ind.n_elem;
   int ndr = B.n_cols;
 
+  // no failures, no estimating equations; PrepareSurv and SurvIndexed reject this
+  if (nFail == 0)
+    return 0;
+
   arma::mat BX = X * B;
 
   arma::rowvec BX_scale = stddev(BX, 0, 0) * bw * sqrt(2.0);
@@ -44,50 +55,77 @@ double surv_dm_f(const arma::mat &B,
   for (int j = 0; j < ndr; j++)
     BX.col(j) /= BX_scale(j);
 
-  arma::mat kernel_matrix;
+  KernelRows kernel_matrix(BX, ncore, 1, kopt);
 
-  if (ncore > 1)
-    kernel_matrix = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix = KernelDist_single(BX, 1);
+  // subjects as columns for contiguous access
+  const arma::mat Xt = X.t();
 
-  arma::mat TheIntegration(P, P, arma::fill::zeros);
+  // Failures of a group (tied times, or a time bin) share the risk set and the
+  // column of Phit, so the sweep runs over groups. The failures of group g lie in
+  // the rows [start(g), start(g + 1)), group_of(k) is the group of row k or -1.
+  int nGroup = tie_group(nFail - 1) + 1;
+  arma::uvec start(nGroup);
+  arma::uvec first(nGroup);
+  arma::ivec group_of(N);
+  group_of.fill(-1);
 
-  for (int i = 0; i < N; i++)
+  for (int j = nFail - 1; j >= 0; j--)
   {
-    arma::rowvec weighted_sum(P, arma::fill::zeros);
+    start(tie_group(j)) = risk_ind(j);
+    first(tie_group(j)) = j;
+    group_of(fail_ind(j)) = tie_group(j);
+  }
+
+  // column g of Rsum is sum_i (delta_ig - lambda_ig) (X_i - E_g[X | i]), added up in
+  // a fixed order so that it is the same for any ncore. The chunk count only depends
+  // on the size of Rsum, which keeps the partial sums within about 1 GB.
+  int nchunk = (int)dmax(1, dmin(reduce_chunks, 1e9 / (8.0 * P * nGroup)));
+
+  arma::mat Rsum = parallelSum(N, nchunk, ncore, arma::mat(P, nGroup, arma::fill::zeros),
+                               [&](int i, arma::mat &Rsum_c) {
+    arma::vec weighted_sum(P, arma::fill::zeros);
+    arma::uvec idx;
+    arma::vec k_i;
+
     double weights = 0;
-    double lambda_j; // the conditional hazard at time point j.
+    double lambda_g; // the conditional hazard of the group
     double delta;
 
-    int j = nFail - 1;
-    int k = N - 1;
-    int fail_j_ind;
+    // nonzero kernel entries of row i, consumed from the largest index down
+    kernel_matrix.row(i, 0, idx, k_i);
+
+    int k = (int)idx.n_elem - 1;
 
     // starting from the last time point
-    for (j = nFail - 1; j >= 0; j--)
+    for (int g = nGroup - 1; g >= 0; g--)
     {
-      // the index
-      fail_j_ind = Fail_Ind[j] - 1;
+      int risk_g_ind = start(g);
+
+      // kernel mass on the failures of the group, met in the same sweep
+      double mass = 0;
 
-      for (; k >= fail_j_ind; k--)
+      for (; k >= 0 && (int)idx(k) >= risk_g_ind; k--)
       {
-        weighted_sum += X.row(k) * kernel_matrix(i, k);
-        weights += kernel_matrix(i, k);
+        weighted_sum += Xt.col(idx(k)) * k_i(k);
+        weights += k_i(k);
+
+        if (group_of(idx(k)) == g)
+          mass += k_i(k);
       }
 
-      // the conditional lambda for subject i at time point j
-      if (i >= fail_j_ind && weights > 0)
+      // the conditional lambda for subject i at the time points of the group
+      if (i >= risk_g_ind && weights > 0)
       {
-        lambda_j = kernel_matrix(i, fail_j_ind) / weights;
-        delta = (fail_j_ind == i);
-
-        // adding the estimating equation
+        lambda_g = mass / weights;
+        delta = (group_of(i) == g);
 
-        TheIntegration += (delta - lambda_j) * Phit.col(j) * (X.row(i) - weighted_sum / weights);
+        Rsum_c.col(g) += (delta - lambda_g) * (Xt.col(i) - weighted_sum / weights);
       }
     }
-  }
+  });
+
+  // sum_g Phit_g R_g' as one GEMM
+  arma::mat TheIntegration = Phit.cols(first) * Rsum.t();
 
   return accu(pow(TheIntegration, 2)) / nFail / nFail;
 }
@@ -97,91 +135,69 @@ void surv_dm_g(arma::mat &B,
                arma::mat &G,
                const arma::mat &X,
                const arma::mat &Phit,
-               const arma::vec &Fail_Ind,
+               const arma::uvec &fail_ind,
+               const arma::uvec &risk_ind,
+               const arma::uvec &tie_group,
                double bw,
                const double epsilon,
-               int ncore)
+               const kernel_plan &plan)
 {
   // This function computes the gradiant of the estimation equations
 
   int P = B.n_rows;
   int ndr = B.n_cols;
 
-#pragma omp parallel num_threads(ncore)
-  {
-    // create one copy of B for each thread
-    arma::mat NewB(P, ndr);
-    NewB = B;
-
-// parallel loop
-#pragma omp for collapse(2) schedule(static)
-    for (int j = 0; j < ndr; j++)
-      for (int i = 0; i < P; i++)
-      {
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
 
-        // small increment
-        double temp = B(i, j);
-        NewB(i, j) = B(i, j) + epsilon;
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
 
-        // calculate gradiant
-        G(i, j) = (surv_dm_f(NewB, X, Phit, Fail_Ind, bw, 1) - F0) / epsilon;
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
 
-        NewB(i, j) = temp;
-      }
-  }
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (surv_dm_f(NewB[t], X, Phit, fail_ind, risk_ind, tie_group, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
 
   return;
 }
 
-//' @title surv_dm_solver \code{C++} function
-//' @name surv_dm_solver
-//' @description The main optimization function for survival dimensional reduction, the IR-Semi method. This is an internal function and should not be called directly.
-//' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X The covariate matrix (This matrix is ordered by the order of Y for faster computation)
-//' @param Phit Phit as defined in Sun et al. (2017)
-//' @param Fail_Ind The locations of the failure subjects
-//' @param bw Kernel bandwidth for X
-//' @param bw_optim whether to optimize the bandwidth
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for approximating numerical gradient
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Estimation equation 2-norm tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @param ncore The number of cores for parallel computing
-//' @return The optimizer \code{B} for the esitmating equation.
-//' @references Sun, Q., Zhu, R., Wang, T. and Zeng, D. "Counting Process Based Dimension Reduction Method for Censored Outcomes." (2017) \url{https://arxiv.org/abs/1704.05046} .
-//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434. DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//' @examples
-//' # This function should be called internally. When having all objects pre-computed, one can call
-//' # surv_solver(B, X, Phit, Fail.Ind,
-//' #             rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose)
-//' # to solve for the parameters B.
-//'
-// [[Rcpp::export]]
-
-py::dict surv_dm_solver(arma::mat B,
-                        const arma::mat &X,
-                        const arma::mat &Phit,
-                        const arma::vec &Fail_Ind,
-                        double bw,
-                        double rho,
-                        double eta,
-                        double gamma,
-                        double tau,
-                        double epsilon,
-                        double btol,
-                        double ftol,
-                        double gtol,
-                        int maxitr,
-                        int verbose,
-                        int ncore)
+// the solver on a prepared survival problem, see surv_problem.h
+
+py::dict surv_dm_solver_prepared(arma::mat B,
+                                 const surv_problem &prob,
+                                 double bw,
+                                 double rho,
+                                 double eta,
+                                 double gamma,
+                                 double tau,
+                                 double epsilon,
+                                 double btol,
+                                 double ftol,
+                                 double gtol,
+                                 int maxitr,
+                                 int verbose,
+                                 int ncore)
 {
+  const arma::mat &X = prob.X;
+  const arma::mat &Phit = prob.Phit;
+  const arma::uvec &fail_ind = prob.fail_ind;
+  const arma::uvec &risk_ind = prob.risk_ind;
+  const arma::uvec &tie_group = prob.tie_group;
 
   int P = B.n_rows;
   int ndr = B.n_cols;
@@ -200,13 +216,21 @@ py::dict surv_dm_solver(arma::mat B,
 
   checkCores(ncore, verbose);
 
+  checkKernel(prob.kopt);
+
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("dm", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
+
   // Initial function value and gradient, prepare for iterations
 
-  double F = surv_dm_f(B, X, Phit, Fail_Ind, bw, ncore);
+  double F = surv_dm_f(B, X, Phit, fail_ind, risk_ind, tie_group, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  surv_dm_g(B, F, G, X, Phit, Fail_Ind, bw, epsilon, ncore);
+  surv_dm_g(B, F, G, X, Phit, fail_ind, risk_ind, tie_group, bw, epsilon, plan);
 
   //return G;
 
@@ -279,8 +303,8 @@ py::dict surv_dm_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = surv_dm_f(B, X, Phit, Fail_Ind, bw, ncore);
-      surv_dm_g(B, F, G, X, Phit, Fail_Ind, bw, epsilon, ncore);
+      F = surv_dm_f(B, X, Phit, fail_ind, risk_ind, tie_group, bw, plan.single, kopt);
+      surv_dm_g(B, F, G, X, Phit, fail_ind, risk_ind, tie_group, bw, epsilon, plan);
 
       if ((F <= (Cval - tau * deriv)) || (nls >= 5))
       {
@@ -377,5 +401,71 @@ py::dict surv_dm_solver(arma::mat B,
   ret["itr"] = itr;
   ret["converge"] = (itr < maxitr);
   ret["bw"] = bw;
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
+
+  // the approximation of binned risk sets, against the exact ones at the solution
+  if (prob.bins > 0)
+  {
+    double F_exact = surv_dm_f(B, X, prob.exact_Phit, fail_ind, prob.exact_risk_ind, prob.exact_tie_group, bw,
+                               plan.single, kopt);
+    ret["binning"] = SurvBinningDict(prob, F, F_exact);
+  }
+
   return (ret);
 }
+
+//' @title surv_dm_solver \code{C++} function
+//' @name surv_dm_solver
+//' @description The main optimization function for survival dimensional reduction, the IR-Semi method. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X The covariate matrix (This matrix is ordered by the order of Y for faster computation)
+//' @param Phit Phit as defined in Sun et al. (2017)
+//' @param Fail_Ind The locations of the failure subjects
+//' @param bw Kernel bandwidth for X
+//' @param bw_optim whether to optimize the bandwidth
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for approximating numerical gradient
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Estimation equation 2-norm tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @return The optimizer \code{B} for the esitmating equation.
+//' @references Sun, Q., Zhu, R., Wang, T. and Zeng, D. "Counting Process Based Dimension Reduction Method for Censored Outcomes." (2017) \url{https://arxiv.org/abs/1704.05046} .
+//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434. DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//' @examples
+//' # This function should be called internally. When having all objects pre-computed, one can call
+//' # surv_solver(B, X, Phit, Fail.Ind,
+//' #             rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose)
+//' # to solve for the parameters B.
+//'
+// [[Rcpp::export]]
+
+py::dict surv_dm_solver(arma::mat B,
+                        const arma::mat &X,
+                        const arma::mat &Phit,
+                        const arma::vec &Fail_Ind,
+                        double bw,
+                        double rho,
+                        double eta,
+                        double gamma,
+                        double tau,
+                        double epsilon,
+                        double btol,
+                        double ftol,
+                        double gtol,
+                        int maxitr,
+                        int verbose,
+                        int ncore,
+                        const kernel_opts &kopt)
+{
+  return surv_dm_solver_prepared(B, *SurvIndexed(X, Phit, Fail_Ind, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                                 ftol, gtol, maxitr, verbose, ncore);
+}
@@ -22,21 +22,25 @@
 
 #include <armadillo>
 #include "utilities.h"
+#include "kernel.h"
+#include "thread_pool.h"
+#include "surv_problem.h"
 
 // [[Rcpp::depends(RcppArmadillo)]]
 
 double surv_forward_f(const arma::mat &B,
                       const arma::mat &X,
-                      const arma::vec &Fail_Ind,
+                      const arma::uvec &fail_ind,
+                      const arma::uvec &risk_ind,
                       double bw,
-                      int ncore)
+                      int ncore,
+                      const kernel_opts &kopt)
 {
   // This function computes the estimation equations and its 2-norm for the survival dimensional reduction model
   // It only implement the dN method, with phi(t)
 
-  int N = X.n_rows;
   int P = X.n_cols;
-  int nFail = Fail_Ind.size();
+  int nFail = fail_ind.n_elem;
   int ndr = B.n_cols;
 
   arma::mat BX = X * B;
@@ -46,35 +50,12 @@ double surv_forward_f(const arma::mat &B,
   for (int j = 0; j < ndr; j++)
     BX.col(j) /= BX_scale(j);
 
-  arma::mat kernel_matrix;
+  // kernel weighted sums of X over the risk sets k >= risk_ind(j), with the weights in the last column
+  arma::mat RiskSums = KernelRiskSums(BX, X, fail_ind, risk_ind, ncore, 1, kopt);
 
-  if (ncore > 1)
-    kernel_matrix = KernelDist_multi(BX, ncore, 1);
-  else
-    kernel_matrix = KernelDist_single(BX, 1);
-
-  arma::rowvec EE(P, arma::fill::zeros);
-
-  for (int j = 0; j < nFail; j++)
-  {
-    int fail_j_ind = Fail_Ind[j] - 1;
-
-    arma::rowvec TheCond(P);
-    TheCond.fill(0);
-    double weights = 0;
-
-    for (int k = fail_j_ind; k < N; k++)
-    {
-      TheCond += X.row(k) * kernel_matrix(k, fail_j_ind);
-      weights += kernel_matrix(k, fail_j_ind);
-    }
-
-    EE += X.row(fail_j_ind) - TheCond / weights;
-
-    //std::cout << "this slice is " << EEALL.slice(j) << std::endl;
-  }
-
-  // arma::mat EE = sum(EEALL, 2);
+  // X at each failure minus its risk set average, summed over the failures
+  arma::mat R = X.rows(fail_ind) - RiskSums.cols(0, P - 1).each_col() / RiskSums.col(P);
+  arma::rowvec EE = sum(R, 0);
 
   return accu(pow(EE, 2)) / nFail / nFail;
 }
@@ -83,89 +64,66 @@ void surv_forward_g(arma::mat &B,
                     double F0,
                     arma::mat &G,
                     const arma::mat &X,
-                    const arma::vec &Fail_Ind,
+                    const arma::uvec &fail_ind,
+                    const arma::uvec &risk_ind,
                     double bw,
                     double epsilon,
-                    int ncore)
+                    const kernel_plan &plan)
 {
   // This function computes the gradiant of the estimation equations
 
   int P = B.n_rows;
   int ndr = B.n_cols;
 
-#pragma omp parallel num_threads(ncore)
-  {
-    // create one copy of B for each thread
-    arma::mat NewB(P, ndr);
-    NewB = B;
-
-    // parallel loop
-#pragma omp for collapse(2) schedule(static)
-    for (int j = 0; j < ndr; j++)
-      for (int i = 0; i < P; i++)
-      {
+  // threads over the coordinates of B and inside each evaluation, from the plan
+  // the solver made once
+  const kernel_opts &kopt = plan.kopt;
 
-        // small increment
-        double temp = B(i, j);
-        NewB(i, j) = B(i, j) + epsilon;
+  // the coordinates of B are tasks of the pool, idle threads steal the remaining
+  // ones when the evaluations differ in cost; one copy of B for each thread
+  std::vector<arma::mat> NewB(plan.outer, B);
 
-        // calculate gradiant
-        G(i, j) = (surv_forward_f(NewB, X, Fail_Ind, bw, 1) - F0) / epsilon;
+  // each outer thread evaluates on inner threads of its own
+  parallelReserve(plan.outer * plan.inner);
 
-        NewB(i, j) = temp;
-      }
-  }
+  parallelFor(P * ndr, plan.outer, [&](int k, int t) {
+    int i = k % P;
+    int j = k / P;
+
+    // small increment
+    double temp = B(i, j);
+    NewB[t](i, j) = B(i, j) + epsilon;
+
+    // calculate gradiant
+    G(i, j) = (surv_forward_f(NewB[t], X, fail_ind, risk_ind, bw, plan.inner, kopt) - F0) / epsilon;
+
+    // reset
+    NewB[t](i, j) = temp;
+  });
 
   return;
 }
 
-//' @title surv_forward_solver \code{C++} function
-//' @name surv_forward_solver
-//' @description The main optimization function for survival dimensional reduction, the forward method. This is an internal function and should not be called directly.
-//' @keywords internal
-//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
-//' @param X The covariate matrix (This matrix is ordered by the order of Y for faster computation)
-//' @param Phit Phit as defined in Sun et al. (2017)
-//' @param Fail_Ind The locations of the failure subjects
-//' @param bw Kernel bandwidth for X
-//' @param rho (don't change) Parameter for control the linear approximation in line search
-//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
-//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
-//' @param tau (don't change) Step size for updating
-//' @param epsilon (don't change) Parameter for approximating numerical gradient
-//' @param btol (don't change) The \code{$B$} parameter tolerance level
-//' @param ftol (don't change) Estimation equation 2-norm tolerance level
-//' @param gtol (don't change) Gradient tolerance level
-//' @param maxitr Maximum number of iterations
-//' @param verbose Should information be displayed
-//' @param ncore The number of cores for parallel computing
-//' @return The optimizer \code{B} for the esitmating equation.
-//' @references Sun, Q., Zhu, R., Wang, T. and Zeng, D. "Counting Process Based Dimension Reduction Method for Censored Outcomes." (2017) \url{https://arxiv.org/abs/1704.05046} .
-//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434. DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
-//' @examples
-//' # This function should be called internally. When having all objects pre-computed, one can call
-//' # surv_solver(B, X, Phit, Fail.Ind,
-//' #             rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose)
-//' # to solve for the parameters B.
-//'
-// [[Rcpp::export]]
-
-py::dict surv_forward_solver(arma::mat B,
-                         const arma::mat &X,
-                         const arma::vec &Fail_Ind,
-                         double bw,
-                         double rho,
-                         double eta,
-                         double gamma,
-                         double tau,
-                         double epsilon,
-                         double btol,
-                         double ftol,
-                         double gtol,
-                         int maxitr,
-                         int verbose,
-                         int ncore)
+// the solver on a prepared survival problem, see surv_problem.h
+
+py::dict surv_forward_solver_prepared(arma::mat B,
+                                      const surv_problem &prob,
+                                      double bw,
+                                      double rho,
+                                      double eta,
+                                      double gamma,
+                                      double tau,
+                                      double epsilon,
+                                      double btol,
+                                      double ftol,
+                                      double gtol,
+                                      int maxitr,
+                                      int verbose,
+                                      int ncore)
 {
+  const arma::mat &X = prob.X;
+  const arma::uvec &fail_ind = prob.fail_ind;
+  const arma::uvec &risk_ind = prob.risk_ind;
 
   int P = B.n_rows;
   int ndr = B.n_cols;
@@ -180,26 +138,30 @@ py::dict surv_forward_solver(arma::mat B,
     eye2P.eye();
   }
 
-  if (ncore > 1)
-    OMPMSG(1);
-  int haveCore = omp_get_max_threads();
-  if (ncore <= 0)
-    ncore = haveCore;
+  // initialize parallel computing
 
-  if (ncore > haveCore)
-  {
-    if (verbose)
-      std::cout << "Do not have " << ncore << " cores, use maximum " << haveCore << " cores." << std::endl;
-    ncore = haveCore;
-  }
+  checkCores(ncore, verbose);
+
+  checkKernel(prob.kopt);
+
+  // the forward objective runs over every failure with its own risk set, coarser risk
+  // sets would only start them earlier at the same cost
+  if (prob.bins > 0)
+    throw std::runtime_error("bins > 0 only applies to the dm solver, prepare the forward problem with bins = 0.");
+
+  // the memory budget may lower the threads or switch the backend, the whole
+  // fit runs on the options of the plan
+  kernel_plan plan = KernelPlan("forward", X.n_rows, P, ndr, ncore, prob.kopt);
+  checkPlan(plan);
+  const kernel_opts &kopt = plan.kopt;
 
   // Initial function value and gradient, prepare for iterations
 
-  double F = surv_forward_f(B, X, Fail_Ind, bw, ncore);
+  double F = surv_forward_f(B, X, fail_ind, risk_ind, bw, plan.single, kopt);
 
   arma::mat G(P, ndr);
   G.fill(0);
-  surv_forward_g(B, F, G, X, Fail_Ind, bw, epsilon, ncore);
+  surv_forward_g(B, F, G, X, fail_ind, risk_ind, bw, epsilon, plan);
 
   //return G;
 
@@ -272,8 +234,8 @@ py::dict surv_forward_solver(arma::mat B,
         B = BP - U * (tau * aa);
       }
 
-      F = surv_forward_f(B, X, Fail_Ind, bw, ncore);
-      surv_forward_g(B, F, G, X, Fail_Ind, bw, epsilon, ncore);
+      F = surv_forward_f(B, X, fail_ind, risk_ind, bw, plan.single, kopt);
+      surv_forward_g(B, F, G, X, fail_ind, risk_ind, bw, epsilon, plan);
 
       if ((F <= (Cval - tau * deriv)) || (nls >= 5))
       {
@@ -369,5 +331,62 @@ py::dict surv_forward_solver(arma::mat B,
   ret["fn"] = F;
   ret["itr"] = itr;
   ret["converge"] = (itr < maxitr);
+  ret["plan"] = KernelPlanDict(plan);
+  ret["kernel"] = KernelReport(X, B, bw, plan.single, kopt);
+
+
   return (ret);
 }
+
+//' @title surv_forward_solver \code{C++} function
+//' @name surv_forward_solver
+//' @description The main optimization function for survival dimensional reduction, the forward method. This is an internal function and should not be called directly.
+//' @keywords internal
+//' @param B A matrix of the parameters \code{B}, the columns are subject to the orthogonality constraint
+//' @param X The covariate matrix (This matrix is ordered by the order of Y for faster computation)
+//' @param Phit Phit as defined in Sun et al. (2017)
+//' @param Fail_Ind The locations of the failure subjects
+//' @param bw Kernel bandwidth for X
+//' @param rho (don't change) Parameter for control the linear approximation in line search
+//' @param eta (don't change) Factor for decreasing the step size in the backtracking line search
+//' @param gamma (don't change) Parameter for updating C by Zhang and Hager (2004)
+//' @param tau (don't change) Step size for updating
+//' @param epsilon (don't change) Parameter for approximating numerical gradient
+//' @param btol (don't change) The \code{$B$} parameter tolerance level
+//' @param ftol (don't change) Estimation equation 2-norm tolerance level
+//' @param gtol (don't change) Gradient tolerance level
+//' @param maxitr Maximum number of iterations
+//' @param verbose Should information be displayed
+//' @param ncore The number of cores for parallel computing
+//' @param kopt Kernel options, see \code{kernel_opts}
+//' @return The optimizer \code{B} for the esitmating equation.
+//' @references Sun, Q., Zhu, R., Wang, T. and Zeng, D. "Counting Process Based Dimension Reduction Method for Censored Outcomes." (2017) \url{https://arxiv.org/abs/1704.05046} .
+//' @references Wen, Z. and Yin, W., "A feasible method for optimization with orthogonality constraints." Mathematical Programming 142.1-2 (2013): 397-434. DOI: \url{https://doi.org/10.1007/s10107-012-0584-1}
+//' @examples
+//' # This function should be called internally. When having all objects pre-computed, one can call
+//' # surv_solver(B, X, Phit, Fail.Ind,
+//' #             rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose)
+//' # to solve for the parameters B.
+//'
+// [[Rcpp::export]]
+
+py::dict surv_forward_solver(arma::mat B,
+                         const arma::mat &X,
+                         const arma::vec &Fail_Ind,
+                         double bw,
+                         double rho,
+                         double eta,
+                         double gamma,
+                         double tau,
+                         double epsilon,
+                         double btol,
+                         double ftol,
+                         double gtol,
+                         int maxitr,
+                         int verbose,
+                         int ncore,
+                         const kernel_opts &kopt)
+{
+  return surv_forward_solver_prepared(B, *SurvIndexed(X, arma::mat(), Fail_Ind, kopt), bw, rho, eta, gamma, tau, epsilon, btol,
+                                      ftol, gtol, maxitr, verbose, ncore);
+}
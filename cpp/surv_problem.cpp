@@ -0,0 +1,208 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+#include "surv_problem.h"
+
+std::shared_ptr<surv_problem> PrepareSurv(const arma::vec &time, const arma::vec &status, const arma::mat &X,
+                                          const std::string &phit, int degree, int bins, const kernel_opts &kopt)
+{
+  checkKernel(kopt);
+
+  int N = X.n_rows;
+
+  if ((int)time.n_elem != N || (int)status.n_elem != N)
+    throw std::runtime_error("time and status must have one entry per row of X.");
+
+  if (!time.is_finite())
+    throw std::runtime_error("time must be finite.");
+
+  if (any(status % (1 - status) != 0))
+    throw std::runtime_error("status must be 0 (censored) or 1 (failure).");
+
+  if (accu(status) == 0)
+    throw std::runtime_error("there must be at least one failure.");
+
+  if (phit != "mean" && phit != "poly")
+    throw std::runtime_error("phit must be \"mean\" or \"poly\".");
+
+  if (phit == "poly" && degree < 0)
+    throw std::runtime_error("degree must be nonnegative.");
+
+  if (bins < 0)
+    throw std::runtime_error("bins must be nonnegative.");
+
+  // stable sort by time, failures first within a tie
+  std::vector<arma::uword> perm(N);
+  std::iota(perm.begin(), perm.end(), 0);
+  std::stable_sort(perm.begin(), perm.end(), [&](arma::uword a, arma::uword b) {
+    if (time(a) != time(b))
+      return time(a) < time(b);
+    return status(a) > status(b);
+  });
+
+  auto prob = std::make_shared<surv_problem>();
+  prob->kopt = kopt;
+  prob->order = arma::uvec(perm);
+  prob->X = X.rows(prob->order);
+  prob->time = time.elem(prob->order);
+  prob->status = arma::conv_to<arma::uvec>::from(status.elem(prob->order));
+
+  // the first row of each run of equal times starts the risk set of the run
+  arma::uvec first(N);
+  for (int i = 0; i < N; i++)
+    first(i) = (i > 0 && prob->time(i) == prob->time(i - 1)) ? first(i - 1) : i;
+
+  prob->fail_ind = find(prob->status == 1);
+  prob->risk_ind = first.elem(prob->fail_ind);
+
+  int nFail = prob->fail_ind.n_elem;
+  prob->tie_group.set_size(nFail);
+
+  for (int j = 0; j < nFail; j++)
+    prob->tie_group(j) = (j == 0) ? 0 : prob->tie_group(j - 1) + (prob->risk_ind(j) != prob->risk_ind(j - 1));
+
+  if (phit == "mean")
+  {
+    // suffix sums of X over the sorted rows give every risk set average
+    arma::mat S = flipud(cumsum(flipud(prob->X), 0));
+    prob->Phit.set_size(X.n_cols, nFail);
+
+    for (int j = 0; j < nFail; j++)
+      prob->Phit.col(j) = S.row(prob->risk_ind(j)).t() / (double)(N - prob->risk_ind(j));
+  }
+  else
+  {
+    arma::vec t = prob->time.elem(prob->fail_ind) / dmax(max(abs(prob->time)), 1e-300);
+    prob->Phit.set_size(degree + 1, nFail);
+    prob->Phit.row(0).ones();
+
+    for (int d = 1; d <= degree; d++)
+      prob->Phit.row(d) = prob->Phit.row(d - 1) % t.t();
+  }
+
+  // nothing to coarsen with fewer distinct failure times than bins
+  int nTie = prob->tie_group(nFail - 1) + 1;
+
+  if (bins == 0 || bins >= nTie)
+    return prob;
+
+  prob->bins = bins;
+  prob->exact_risk_ind = prob->risk_ind;
+  prob->exact_tie_group = prob->tie_group;
+  prob->exact_Phit = prob->Phit;
+
+  // quantile bins by failure count, a tie run goes to the bin of its first failure
+  arma::uvec bin(nFail);
+  arma::uword run_first = 0;
+
+  for (int j = 0; j < nFail; j++)
+  {
+    if (j == 0 || prob->exact_tie_group(j) != prob->exact_tie_group(j - 1))
+      run_first = j;
+
+    bin(j) = run_first * bins / nFail;
+  }
+
+  // renumber the bins that are not empty, each takes its first failure's risk set
+  for (int j = 0; j < nFail; j++)
+  {
+    bool new_bin = (j == 0 || bin(j) != bin(j - 1));
+
+    prob->tie_group(j) = (j == 0) ? 0 : prob->tie_group(j - 1) + new_bin;
+    prob->risk_ind(j) = new_bin ? prob->exact_risk_ind(j) : prob->risk_ind(j - 1);
+  }
+
+  // Phit averaged within each bin
+  int nBin = prob->tie_group(nFail - 1) + 1;
+
+  for (int b = 0; b < nBin; b++)
+  {
+    arma::uvec members = find(prob->tie_group == (arma::uword)b);
+    arma::vec phi = mean(prob->exact_Phit.cols(members), 1);
+
+    prob->Phit.cols(members).each_col() = phi;
+  }
+
+  return prob;
+}
+
+py::dict SurvBinningDict(const surv_problem &prob, double fn_binned, double fn_exact)
+{
+  py::dict report;
+  report["bins"] = prob.bins;
+  report["groups"] = (int)(prob.tie_group(prob.tie_group.n_elem - 1) + 1);
+  report["fn_binned"] = fn_binned;
+  report["fn_exact"] = fn_exact;
+  report["abs_error"] = std::abs(fn_binned - fn_exact);
+  report["rel_error"] = std::abs(fn_binned - fn_exact) / dmax(std::abs(fn_exact), 1e-300);
+  return report;
+}
+
+std::shared_ptr<surv_problem> SurvIndexed(const arma::mat &X, const arma::mat &Phit, const arma::vec &Fail_Ind,
+                                          const kernel_opts &kopt)
+{
+  int N = X.n_rows;
+
+  if (Fail_Ind.n_elem == 0)
+    throw std::runtime_error("there must be at least one failure.");
+
+  if (Fail_Ind.min() < 1 || Fail_Ind.max() > N)
+    throw std::runtime_error("Fail_Ind must be 1-based rows of X.");
+
+  auto prob = std::make_shared<surv_problem>();
+  prob->kopt = kopt;
+  prob->X = X;
+  prob->Phit = Phit;
+  prob->order = arma::regspace<arma::uvec>(0, N - 1);
+  prob->fail_ind = arma::conv_to<arma::uvec>::from(Fail_Ind - 1);
+  prob->risk_ind = prob->fail_ind;
+  prob->tie_group = arma::regspace<arma::uvec>(0, (int)prob->fail_ind.n_elem - 1);
+
+  return prob;
+}
+
+py::dict SurvSolve(const surv_problem &prob, const std::string &method, arma::mat B, double bw, double rho,
+                   double eta, double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                   int maxitr, int verbose, int ncore)
+{
+  if (B.n_rows != prob.X.n_cols)
+    throw std::runtime_error("B must have one row per column of X.");
+
+  if (method == "dn")
+    return surv_dn_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose,
+                                   ncore);
+  if (method == "dm")
+    return surv_dm_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose,
+                                   ncore);
+  if (method == "forward")
+    return surv_forward_solver_prepared(B, prob, bw, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr,
+                                        verbose, ncore);
+
+  throw std::runtime_error("survival method must be one of \"dn\", \"dm\", \"forward\".");
+}
@@ -0,0 +1,97 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <string>
+#include <memory>
+#include <armadillo>
+#include "utilities.h"
+#include "kernel.h"
+
+#ifndef orthoDr_surv_problem
+#define orthoDr_surv_problem
+
+// Prepared survival problem, shared by the dn, dm and forward solvers. The rows
+// are sorted by observed time (stable, failures before censored at a tied time)
+// and all indices are 0-based:
+//   order:     row i of X is row order(i) of the input
+//   fail_ind:  the failure rows
+//   risk_ind:  first row of the risk set of each failure, the first row with the
+//              same observed time, so tied failures share one risk set
+//   tie_group: failures with the same time share a group, numbered 0, 1, ...
+//   Phit:      the basis phi(t) at each failure time, one column per failure,
+//              constant within a group
+// With bins > 0 the failure times are coarsened into that many quantile bins: the
+// failures of a bin form one group with the risk set of its earliest failure and
+// the average of their Phit columns. Only dm works per group, so only dm accepts
+// a binned problem. The exact risk sets, groups and Phit are kept to report the
+// error of the approximation at the solution.
+
+struct surv_problem
+{
+  arma::mat X;
+  arma::vec time;
+  arma::uvec status;
+  arma::uvec order;
+  arma::uvec fail_ind;
+  arma::uvec risk_ind;
+  arma::uvec tie_group;
+  arma::mat Phit;
+  kernel_opts kopt;
+
+  int bins = 0;
+  arma::uvec exact_risk_ind;
+  arma::uvec exact_tie_group;
+  arma::mat exact_Phit;
+};
+
+// from raw (time, status, X); phit is "mean" (the risk set average of X) or "poly"
+// (1, t, ..., t^degree with t scaled by the largest time), bins = 0 for exact risk sets
+std::shared_ptr<surv_problem> PrepareSurv(const arma::vec &time, const arma::vec &status, const arma::mat &X,
+                                          const std::string &phit, int degree, int bins, const kernel_opts &kopt);
+
+// objective at the solution with the binned and with the exact risk sets
+py::dict SurvBinningDict(const surv_problem &prob, double fn_binned, double fn_exact);
+
+// the problem of the legacy solver interface: X sorted by the caller, Phit given and
+// 1-based Fail_Ind, every failure being its own risk set start
+std::shared_ptr<surv_problem> SurvIndexed(const arma::mat &X, const arma::mat &Phit, const arma::vec &Fail_Ind,
+                                          const kernel_opts &kopt);
+
+py::dict surv_dn_solver_prepared(arma::mat B, const surv_problem &prob, double bw, double rho, double eta,
+                                 double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                                 int maxitr, int verbose, int ncore);
+
+py::dict surv_dm_solver_prepared(arma::mat B, const surv_problem &prob, double bw, double rho, double eta,
+                                 double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                                 int maxitr, int verbose, int ncore);
+
+py::dict surv_forward_solver_prepared(arma::mat B, const surv_problem &prob, double bw, double rho, double eta,
+                                      double gamma, double tau, double epsilon, double btol, double ftol,
+                                      double gtol, int maxitr, int verbose, int ncore);
+
+// python entry point, method is "dn", "dm" or "forward"
+py::dict SurvSolve(const surv_problem &prob, const std::string &method, arma::mat B, double bw, double rho,
+                   double eta, double gamma, double tau, double epsilon, double btol, double ftol, double gtol,
+                   int maxitr, int verbose, int ncore);
+
+#endif
@@ -0,0 +1,368 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "utilities.h"
+#include "thread_pool.h"
+
+// The task range [begin, end) of a thread, packed into one word so that the
+// owner taking from the front and a thief cutting the back agree through one CAS
+static inline uint64_t packRange(uint32_t begin, uint32_t end)
+{
+  return ((uint64_t)end << 32) | begin;
+}
+
+static inline uint32_t rangeBegin(uint64_t r) { return (uint32_t)r; }
+static inline uint32_t rangeEnd(uint64_t r) { return (uint32_t)(r >> 32); }
+
+struct PoolJob
+{
+  const std::function<void(int, int)> *fn;
+  int nslot;
+  std::unique_ptr<std::atomic<uint64_t>[]> range;
+
+  // threads that took a slot, and tasks not finished yet
+  std::atomic<int> joined;
+  std::atomic<int> left;
+
+  std::mutex lock;
+  std::condition_variable done;
+  std::exception_ptr error;
+};
+
+class ThreadPool
+{
+public:
+  ~ThreadPool();
+
+  void run(int n, int nthread, const std::function<void(int, int)> &fn);
+  void reserve(int nthread);
+  void resize(int nthread);
+
+  int limit = 0;
+
+  int size()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return (int)workers.size() + 1;
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::vector<std::shared_ptr<PoolJob>> jobs;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool stop = false;
+
+  void grow(int nthread);
+  void halt();
+  void loop();
+  bool open(std::shared_ptr<PoolJob> &job, int &slot);
+};
+
+static ThreadPool &pool()
+{
+  static ThreadPool instance;
+  return instance;
+}
+
+// next task of the thread's own range
+static bool takeTask(std::atomic<uint64_t> &range, int &i)
+{
+  uint64_t r = range.load();
+
+  while (rangeBegin(r) < rangeEnd(r))
+  {
+    if (range.compare_exchange_weak(r, packRange(rangeBegin(r) + 1, rangeEnd(r))))
+    {
+      i = rangeBegin(r);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// move the back half of the largest range into the empty range of slot
+static bool stealTasks(PoolJob &job, int slot)
+{
+  for (;;)
+  {
+    int victim = -1;
+    uint32_t most = 0;
+
+    for (int s = 0; s < job.nslot; s++)
+    {
+      uint64_t r = job.range[s].load();
+
+      if (rangeEnd(r) > rangeBegin(r) && rangeEnd(r) - rangeBegin(r) > most)
+      {
+        most = rangeEnd(r) - rangeBegin(r);
+        victim = s;
+      }
+    }
+
+    if (victim < 0)
+      return false;
+
+    uint64_t r = job.range[victim].load();
+    uint32_t b = rangeBegin(r);
+    uint32_t e = rangeEnd(r);
+
+    if (b >= e)
+      continue;
+
+    uint32_t mid = b + (e - b) / 2;
+
+    // only the owner writes an empty range, so the store cannot race
+    if (job.range[victim].compare_exchange_strong(r, packRange(b, mid)))
+    {
+      job.range[slot].store(packRange(mid, e));
+      return true;
+    }
+  }
+}
+
+static void workJob(PoolJob &job, int slot)
+{
+  int i;
+
+  for (;;)
+  {
+    if (!takeTask(job.range[slot], i))
+    {
+      if (!stealTasks(job, slot))
+        return;
+
+      continue;
+    }
+
+    try
+    {
+      (*job.fn)(i, slot);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> guard(job.lock);
+      if (!job.error)
+        job.error = std::current_exception();
+    }
+
+    if (job.left.fetch_sub(1) == 1)
+    {
+      std::lock_guard<std::mutex> guard(job.lock);
+      job.done.notify_all();
+    }
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  halt();
+}
+
+void ThreadPool::halt()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+
+  wake.notify_all();
+
+  for (auto &w : workers)
+    w.join();
+
+  workers.clear();
+  stop = false;
+}
+
+void ThreadPool::grow(int nthread)
+{
+  std::lock_guard<std::mutex> guard(lock);
+
+  while ((int)workers.size() < nthread - 1)
+    workers.emplace_back(&ThreadPool::loop, this);
+}
+
+void ThreadPool::reserve(int nthread)
+{
+  if (limit > 0)
+    nthread = (int)imin(nthread, limit);
+
+  grow(nthread);
+}
+
+void ThreadPool::resize(int nthread)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!jobs.empty())
+      throw std::runtime_error("the thread pool cannot be resized while a solver is running.");
+  }
+
+  halt();
+  grow(nthread);
+  limit = nthread;
+}
+
+// the newest job with a free slot and tasks left; nested jobs are newer than the
+// tasks waiting on them, so they are served first
+bool ThreadPool::open(std::shared_ptr<PoolJob> &job, int &slot)
+{
+  for (int k = (int)jobs.size() - 1; k >= 0; k--)
+  {
+    if (jobs[k]->left.load() > 0 && jobs[k]->joined.load() < jobs[k]->nslot)
+    {
+      job = jobs[k];
+      slot = job->joined.fetch_add(1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::loop()
+{
+  for (;;)
+  {
+    std::shared_ptr<PoolJob> job;
+    int slot = 0;
+
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [&] { return stop || open(job, slot); });
+
+      if (stop)
+        return;
+    }
+
+    workJob(*job, slot);
+  }
+}
+
+void ThreadPool::run(int n, int nthread, const std::function<void(int, int)> &fn)
+{
+  if (limit > 0)
+    nthread = (int)imin(nthread, limit);
+
+  nthread = (int)imin(nthread, n);
+
+  if (n <= 0)
+    return;
+
+  // nothing to share, no synchronization
+  if (nthread <= 1)
+  {
+    for (int i = 0; i < n; i++)
+      fn(i, 0);
+
+    return;
+  }
+
+  grow(nthread);
+
+  auto job = std::make_shared<PoolJob>();
+  job->fn = &fn;
+  job->nslot = nthread;
+  job->range.reset(new std::atomic<uint64_t>[nthread]);
+  job->joined = 1;
+  job->left = n;
+
+  // contiguous starting ranges, the caller takes slot 0
+  for (int s = 0; s < nthread; s++)
+    job->range[s].store(packRange((uint64_t)n * s / nthread, (uint64_t)n * (s + 1) / nthread));
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(job);
+  }
+
+  wake.notify_all();
+  workJob(*job, 0);
+
+  {
+    std::unique_lock<std::mutex> guard(job->lock);
+    job->done.wait(guard, [&] { return job->left.load() == 0; });
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (size_t k = 0; k < jobs.size(); k++)
+      if (jobs[k] == job)
+      {
+        jobs.erase(jobs.begin() + k);
+        break;
+      }
+  }
+
+  if (job->error)
+    std::rethrow_exception(job->error);
+}
+
+void parallelFor(int n, int nthread, const std::function<void(int, int)> &fn)
+{
+  pool().run(n, nthread, fn);
+}
+
+void parallelReserve(int nthread)
+{
+  pool().reserve(nthread);
+}
+
+//' @title thread_pool
+//' @name thread_pool
+//' @description Set the number of threads of the persistent pool used by the solvers
+//' @keywords internal
+//' @param ncore Number of threads, the calling thread included, 0 for all cores
+// [[Rcpp::export]]
+py::dict thread_pool(int ncore)
+{
+  checkCores(ncore, 0);
+  pool().resize(ncore);
+
+  return thread_pool_info();
+}
+
+//' @title thread_pool_info
+//' @name thread_pool_info
+//' @description Threads of the persistent pool, the calling thread included, and the limit set by thread_pool
+//' @keywords internal
+// [[Rcpp::export]]
+py::dict thread_pool_info()
+{
+  py::dict ret;
+  ret["threads"] = pool().size();
+  ret["limit"] = pool().limit;
+  return (ret);
+}
@@ -0,0 +1,82 @@
+//    ----------------------------------------------------------------
+//
+//    Orthogonality Constrained Optimization for Dimension Reduction
+//    (orthoDr)
+//
+//    This program is free software; you can redistribute it and/or
+//    modify it under the terms of the GNU General Public License
+//    as published by the Free Software Foundation; either version 3
+//    of the License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public
+//    License along with this program; if not, write to the Free
+//    Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+//    Boston, MA  02110-1301, USA.
+//
+//    ----------------------------------------------------------------
+
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <pybind11/pybind11.h>
+
+#ifndef orthoDr_thread_pool
+#define orthoDr_thread_pool
+
+// Persistent worker threads shared by every solver call of the module, so that
+// short objective evaluations do not pay for starting a thread team each time.
+// A call hands out the indices [0, n) as tasks: each participating thread starts
+// with a contiguous range and, once it runs dry, steals half of the largest
+// range left. The calling thread takes part, and a task may itself call
+// parallelFor, the nested tasks being picked up by whichever threads are idle.
+
+// fn(i, t) for every i in [0, n) on at most nthread threads, t < nthread numbers
+// the thread within this call for per thread buffers. The first exception thrown
+// by a task is rethrown in the caller once all tasks are done.
+void parallelFor(int n, int nthread, const std::function<void(int, int)> &fn);
+
+// start nthread threads (within the limit of thread_pool) before a parallelFor
+// whose tasks call parallelFor again; a call only grows the pool to its own
+// nthread, which for nested calls is one level and not their product
+void parallelReserve(int nthread);
+
+// Sums that come out bitwise the same for any number of threads: [0, n) is cut
+// into at most nchunk contiguous chunks, a split that only depends on n, each
+// chunk is added up in index order into its own copy of zero by fn(i, acc), and
+// the chunk sums are added in chunk order. The cost over per thread partial sums
+// is nchunk accumulators and one ordered pass over them.
+const int reduce_chunks = 64;
+
+template <typename T, typename F>
+T parallelSum(int n, int nchunk, int nthread, const T &zero, F fn)
+{
+  nchunk = std::max(1, std::min(n, nchunk));
+  std::vector<T> part(nchunk, zero);
+
+  parallelFor(nchunk, nthread, [&](int c, int) {
+    int end = (int)((long long)n * (c + 1) / nchunk);
+
+    for (int i = (int)((long long)n * c / nchunk); i < end; i++)
+      fn(i, part[c]);
+  });
+
+  T total = zero;
+
+  for (int c = 0; c < nchunk; c++)
+    total += part[c];
+
+  return total;
+}
+
+// fix the threads of the pool, the caller included; until then the pool grows
+// with the largest ncore requested
+pybind11::dict thread_pool(int ncore);
+pybind11::dict thread_pool_info();
+
+#endif
@@ -20,8 +20,11 @@
 //
 //    ----------------------------------------------------------------
 
+#include <thread>
 #include <armadillo>
 #include "utilities.h"
+#include "thread_pool.h"
+#include "kernel_registry.h"
 
 // [[Rcpp::depends(RcppArmadillo)]]
 
@@ -57,13 +60,12 @@ double imin(int a, int b)
   return a;
 }
 
-// check cores
+// check cores, the threads run on the pool of thread_pool.h so the cap is the
+// hardware and not the OpenMP runtime
 
 void checkCores(int &ncore, int verbose)
 {
-  if (ncore > 1)
-    OMPMSG(1);
-  int haveCore = omp_get_max_threads();
+  int haveCore = (int)imax(1, std::thread::hardware_concurrency());
   if (ncore <= 0)
     ncore = haveCore;
 
@@ -75,20 +77,20 @@ void checkCores(int &ncore, int verbose)
   }
 }
 
-// kernel distance functions
+// kernel distance functions, one template per layout with the kernel inlined
 
-arma::mat KernelDist_multi(const arma::mat &X, int ncore, double diag)
+template <typename Kern>
+static arma::mat kernel_dist_multi(const arma::mat &X, int ncore, double diag)
 {
   int N = X.n_rows;
   arma::mat kernel_matrix(N, N);
 
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < (int)ceil((double)N / 2); i++)
-  {
+  // rows i and N - i - 1 together balance the triangle over the threads
+  parallelFor((int)ceil((double)N / 2), ncore, [&](int i, int) {
     kernel_matrix(i, i) = diag;
     for (int j = 0; j < i; j++)
     {
-      kernel_matrix(j, i) = exp(-sum(pow(X.row(i) - X.row(j), 2)));
+      kernel_matrix(j, i) = Kern::value(sum(pow(X.row(i) - X.row(j), 2)));
       kernel_matrix(i, j) = kernel_matrix(j, i);
     }
 
@@ -96,15 +98,16 @@ arma::mat KernelDist_multi(const arma::mat &X, int ncore, double diag)
     kernel_matrix(m, m) = diag;
     for (int j = 0; j < m; j++)
     {
-      kernel_matrix(j, m) = exp(-sum(pow(X.row(m) - X.row(j), 2)));
+      kernel_matrix(j, m) = Kern::value(sum(pow(X.row(m) - X.row(j), 2)));
       kernel_matrix(m, j) = kernel_matrix(j, m);
     }
-  }
+  });
 
   return (kernel_matrix);
 }
 
-arma::mat KernelDist_single(const arma::mat &X, double diag)
+template <typename Kern>
+static arma::mat kernel_dist_single(const arma::mat &X, double diag)
 {
   int N = X.n_rows;
   arma::mat kernel_matrix(N, N);
@@ -114,7 +117,7 @@ arma::mat KernelDist_single(const arma::mat &X, double diag)
     kernel_matrix(i, i) = diag;
     for (int j = 0; j < i; j++)
     {
-      kernel_matrix(j, i) = exp(-sum(pow(X.row(i) - X.row(j), 2)));
+      kernel_matrix(j, i) = Kern::value(sum(pow(X.row(i) - X.row(j), 2)));
       kernel_matrix(i, j) = kernel_matrix(j, i);
     }
   }
@@ -122,85 +125,36 @@ arma::mat KernelDist_single(const arma::mat &X, double diag)
   return (kernel_matrix);
 }
 
-arma::mat EpanKernelDist_single(const arma::mat &X, double diag)
-{
-  int N = X.n_rows;
-  arma::mat kernel_matrix(N, N, arma::fill::zeros);
-  double u;
+// every layout goes through the registry dispatch, the kernel is a kernel_type
 
-  for (int i = 0; i < N; i++)
-  {
-    kernel_matrix(i, i) = diag;
-    for (int j = 0; j < i; j++)
-    {
-      u = sum(pow(X.row(i) - X.row(j), 2));
+static arma::mat kernel_dist(const arma::mat &X, int ncore, double diag, kernel_type type)
+{
+  return kernelDispatch(type, [&](auto kern) -> arma::mat {
+    using Kern = decltype(kern);
 
-      if (u > -1 && u < 1)
-        kernel_matrix(j, i) = pow((1 - u * u), 3);
+    if (ncore > 1)
+      return kernel_dist_multi<Kern>(X, ncore, diag);
 
-      kernel_matrix(i, j) = kernel_matrix(j, i);
-    }
-  }
-  return (kernel_matrix);
+    return kernel_dist_single<Kern>(X, diag);
+  });
 }
 
-arma::mat EpanKernelDist_multi(const arma::mat &X, int ncore, double diag)
+arma::mat KernelDist_multi(const arma::mat &X, int ncore, double diag)
 {
-  int N = X.n_rows;
-  arma::mat kernel_matrix(N, N, arma::fill::zeros);
-
-#pragma omp parallel for schedule(static) num_threads(ncore)
-  for (int i = 0; i < (int)ceil((double)N / 2); i++)
-  {
-    double u;
-    kernel_matrix(i, i) = diag;
-    for (int j = 0; j < i; j++)
-    {
-      u = sum(pow(X.row(i) - X.row(j), 2));
-
-      if (u > -1 && u < 1)
-        kernel_matrix(j, i) = pow((1 - u * u), 3);
-
-      kernel_matrix(i, j) = kernel_matrix(j, i);
-    }
-
-    int m = N - i - 1;
-    kernel_matrix(m, m) = diag;
-    for (int j = 0; j < m; j++)
-    {
-      u = sum(pow(X.row(i) - X.row(j), 2));
-
-      if (u > -1 && u < 1)
-        kernel_matrix(j, i) = pow((1 - u * u), 3);
-
-      kernel_matrix(m, j) = kernel_matrix(j, m);
-    }
-  }
-
-  return (kernel_matrix);
+  return kernel_dist(X, ncore, diag, KERNEL_GAUSSIAN);
 }
 
-//' @title KernelDist_cross
-//' @name KernelDist_cross
-//' @description Calculate the kernel distance between testing data and training data
-//' @keywords internal
-//' @param TestX testing data
-//' @param X training data
-// [[Rcpp::export]]
-arma::mat KernelDist_cross(const arma::mat &TestX, const arma::mat &X)
+arma::mat KernelDist_single(const arma::mat &X, double diag)
 {
+  return kernel_dist(X, 1, diag, KERNEL_GAUSSIAN);
+}
 
-  int N = X.n_rows;
-  int TestN = TestX.n_rows;
-
-  arma::mat kernel_matrix(TestN, N);
+arma::mat EpanKernelDist_single(const arma::mat &X, double diag)
+{
+  return kernel_dist(X, 1, diag, KERNEL_EPAN_LEGACY);
+}
 
-  for (int i = 0; i < TestN; i++)
-  {
-    for (int j = 0; j < N; j++)
-    {
-      kernel_matrix(i, j) = exp(-sum(pow(TestX.row(i) - X.row(j), 2)));
-    }
-  }
-  return (kernel_matrix);
+arma::mat EpanKernelDist_multi(const arma::mat &X, int ncore, double diag)
+{
+  return kernel_dist(X, ncore, diag, KERNEL_EPAN_LEGACY);
 }
@@ -20,15 +20,6 @@
 //
 //    ----------------------------------------------------------------
 
-#ifdef _OPENMP
-#include <omp.h>
-#define OMPMSG(...)
-#else
-#define omp_get_thread_num() 0
-#define omp_get_max_threads() 1
-#define OMPMSG(...) printf("Package is not compiled with OpenMP (omp.h).\n")
-#endif
-
 #include <armadillo>
 #include <pybind11/pybind11.h>
 
@@ -51,6 +42,6 @@ arma::mat KernelDist_single(const arma::mat &X, double diag);
 arma::mat EpanKernelDist_multi(const arma::mat &X, int ncore, double diag);
 arma::mat EpanKernelDist_single(const arma::mat &X, double diag);
 
-arma::mat KernelDist_cross(const arma::mat &TestX, const arma::mat &X);
+arma::mat KernelDist_cross(const arma::mat &TestX, const arma::mat &X, int ncore = 0);
 
 #endif
@@ -0,0 +1,218 @@
+"""Dense numpy versions of the objectives as they were written before the
+kernel engine, used to check the reformulated C++ objectives and gradients."""
+
+import numpy as np
+
+
+def regression(N=150, P=4, ndr=2, seed=1):
+    rng = np.random.RandomState(seed)
+    X = rng.randn(N, P)
+    Y = X[:, :1] + np.sin(X[:, 1:2]) + 0.2 * rng.randn(N, 1)
+    B = np.linalg.qr(rng.randn(P, ndr))[0]
+    return B, X, Y
+
+
+def scaled(B, X, bw):
+    BX = X @ B
+    return BX / (BX.std(axis=0, ddof=1) * bw * np.sqrt(2.0))
+
+
+def gaussian(Z):
+    return np.exp(-((Z[:, None, :] - Z[None, :, :]) ** 2).sum(-1))
+
+
+# the kernels of kernel_registry.h as functions of the squared distance
+KERNELS = {
+    "gaussian": lambda d2: np.exp(-d2),
+    "laplace": lambda d2: np.exp(-np.sqrt(d2)),
+    "epanechnikov": lambda d2: np.where(d2 < 1, 1 - d2, 0.0),
+    "biweight": lambda d2: np.where(d2 < 1, (1 - d2) ** 2, 0.0),
+    "triweight": lambda d2: np.where(d2 < 1, (1 - d2) ** 3, 0.0),
+    "epan_legacy": lambda d2: np.where(d2 < 1, (1 - d2 ** 2) ** 3, 0.0),
+}
+
+
+def kernel_dense(Z, kernel="gaussian", diag=1.0):
+    K = KERNELS[kernel](((Z[:, None, :] - Z[None, :, :]) ** 2).sum(-1))
+    np.fill_diagonal(K, diag)
+    return K
+
+
+def gradient(f, B, epsilon=1e-5):
+    # forward differences, as in the *_g functions
+    F0 = f(B)
+    G = np.zeros_like(B)
+
+    for idx in np.ndindex(*B.shape):
+        NewB = B.copy()
+        NewB[idx] += epsilon
+        G[idx] = (f(NewB) - F0) / epsilon
+
+    return G
+
+
+def assert_same_objective(f, ref, B, rtol=1e-8):
+    F, F_ref = f(B), ref(B)
+    assert np.isclose(F, F_ref, rtol=rtol, atol=0)
+
+    # rounding in F of about rtol * F becomes rtol * F / epsilon in the differences
+    G, G_ref = gradient(f, B), gradient(ref, B)
+    assert np.allclose(G, G_ref, rtol=1e-4, atol=rtol * abs(F_ref) / 1e-5)
+
+
+def sir_dense(B, X, Y, bw):
+    N = X.shape[0]
+    K = gaussian(scaled(B, X, bw))
+    Kx = K.sum(0)
+    Ky = gaussian(Y)
+
+    Exy = Ky @ X / Ky.sum(0)[:, None]
+    Ex = K @ X / Kx[:, None]
+    Exyx = K @ Exy / Kx[:, None]
+
+    Est = np.zeros((X.shape[1], X.shape[1]))
+    for i in range(N):
+        Est += np.outer(Exy[i] - Exyx[i], X[i] - Ex[i])
+
+    return (Est ** 2).sum() / N / N
+
+
+def save_dense(B, X, Y, bw):
+    N, P = X.shape
+    K = gaussian(scaled(B, X, bw))
+    Kx = K.sum(0)
+    Ky = gaussian(Y)
+    Ky_sum = Ky.sum(0)
+
+    Est = np.zeros((P, P))
+    for i in range(N):
+        # I - cov[X | Y]_i and cov[X | BX]_i, the slices of the two cubes
+        Mxy = Ky[i] @ X / Ky_sum[i]
+        Covxy = np.eye(P) - np.einsum("j,jk,jl->kl", Ky[i], X, X) / Ky_sum[i] + np.outer(Mxy, Mxy)
+        Ex = K[i] @ X / Kx[i]
+        Covxx = np.einsum("j,jk,jl->kl", K[i], X, X) / Kx[i] - np.outer(Ex, Ex)
+
+        Est += Covxy @ (np.outer(X[i] - Mxy, X[i] - Ex) - Covxx)
+
+    return ((Est / N) ** 2).sum()
+
+
+def phd_dense(B, X, Y, bw):
+    N = X.shape[0]
+    K = gaussian(scaled(B, X, bw))
+    Kx = K.sum(0)
+
+    Est = np.zeros((X.shape[1], X.shape[1]))
+    for i in range(N):
+        XX_BX = np.einsum("j,jk,jl->kl", K[i], X, X) / Kx[i]
+        EY_BX = K[i] @ Y[:, 0] / Kx[i]
+        Est += (np.outer(X[i], X[i]) - XX_BX) * (Y[i, 0] - EY_BX)
+
+    return (Est ** 2).sum() / N / N
+
+
+def local_linear(BX, w_x, z):
+    # weighted least squares of z on [1, BX - BX_i] with weights w_x, row i
+    # at a time on the sqrt(w) weighted design
+    N, ndr = BX.shape
+    beta = np.zeros((N, ndr + 1))
+
+    for i in range(N):
+        s = np.sqrt(w_x[:, i])
+        X_w = np.column_stack([s, (BX - BX[i]) * s[:, None]])
+        beta[i] = np.linalg.lstsq(X_w, z(i) * s, rcond=None)[0]
+
+    return beta[:, 0], beta[:, 1:]
+
+
+def local_dense(B, X, Y, bw):
+    N = X.shape[0]
+    BX = scaled(B, X, bw)
+    K = gaussian(BX)
+    Ex = K @ X / K.sum(0)[:, None]
+
+    a, b = local_linear(BX, K, lambda i: Y[:, 0])
+
+    Seff_sum = (X - Ex).T @ (b * (Y[:, 0] - a)[:, None])
+    return (Seff_sum ** 2 / N / N).sum()
+
+
+def seff_dense(B, X, Y, bw):
+    N = X.shape[0]
+    BX = scaled(B, X, bw)
+    K = gaussian(BX)
+    Ky = gaussian(Y)
+    Ex = K @ X / K.sum(0)[:, None]
+
+    # the weighted response is Ky_i sqrt(Kx_i), divided by sqrt(Kx_i) here
+    a, b = local_linear(BX, K, lambda i: Ky[:, i])
+
+    Seff_sum = (X - Ex).T @ (b / a[:, None])
+    return ((Seff_sum / N) ** 2).sum()
+
+
+def survival(N=150, P=4, ndr=2, seed=2):
+    # rows sorted by time, Fail_Ind 1-based as in the R interface
+    rng = np.random.RandomState(seed)
+    X = rng.randn(N, P)
+    X = X[np.argsort(np.exp(X[:, 0] + 0.5 * rng.randn(N)))]
+    Fail_Ind = np.flatnonzero(rng.rand(N) < 0.7) + 1.0
+    Phit = rng.randn(P, Fail_Ind.size)
+    B = np.linalg.qr(rng.randn(P, ndr))[0]
+    return B, X, Phit, Fail_Ind
+
+
+def surv_solver_fn(solver, *data, bw=0.5):
+    # objective at B: no iterations, rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose, ncore
+    B, rest = data[0], data[1:]
+    return solver(B, *rest, bw, 1.0, 0.2, 0.85, 1e-3, 1e-5, 1e-6, 1e-6, 1e-6, 0, 0, 1)["fn"]
+
+
+def surv_dn_dense(B, X, Phit, Fail_Ind, bw):
+    N, P = X.shape
+    K = gaussian(scaled(B, X, bw))
+    EE = np.zeros((Phit.shape[0], P))
+
+    for j, f in enumerate(Fail_Ind.astype(int) - 1):
+        TheCond = K[f:, f] @ X[f:]
+        weights = K[f:, f].sum()
+        if weights > 0:
+            EE += np.outer(Phit[:, j], X[f] - TheCond / weights)
+
+    return (EE ** 2).sum() / Fail_Ind.size ** 2
+
+
+def surv_forward_dense(B, X, Fail_Ind, bw):
+    K = gaussian(scaled(B, X, bw))
+    EE = np.zeros(X.shape[1])
+
+    for f in Fail_Ind.astype(int) - 1:
+        EE += X[f] - K[f:, f] @ X[f:] / K[f:, f].sum()
+
+    return (EE ** 2).sum() / Fail_Ind.size ** 2
+
+
+def surv_dm_dense(B, X, Phit, Fail_Ind, bw):
+    N, P = X.shape
+    K = gaussian(scaled(B, X, bw))
+    fail = Fail_Ind.astype(int) - 1
+    TheIntegration = np.zeros((Phit.shape[0], P))
+
+    for i in range(N):
+        weighted_sum = np.zeros(P)
+        weights = 0.0
+        k = N - 1
+
+        # from the last time point, the risk set grows as k moves down
+        for j in range(fail.size - 1, -1, -1):
+            while k >= fail[j]:
+                weighted_sum += X[k] * K[i, k]
+                weights += K[i, k]
+                k -= 1
+
+            if i >= fail[j] and weights > 0:
+                lambda_j = K[i, fail[j]] / weights
+                delta = float(fail[j] == i)
+                TheIntegration += (delta - lambda_j) * np.outer(Phit[:, j], X[i] - weighted_sum / weights)
+
+    return (TheIntegration ** 2).sum() / fail.size ** 2
@@ -0,0 +1,76 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+
+# rho, eta, gamma, tau, epsilon, btol, ftol, gtol, maxitr, verbose
+SOLVER = (1.0, 0.2, 0.85, 1e-3, 1e-5, 1e-6, 1e-6, 1e-6, 3, 0)
+NCORE = 4
+
+
+def regression(N=600, P=4, ndr=2, seed=1):
+    rng = np.random.RandomState(seed)
+    X = rng.randn(N, P)
+    Y = (X[:, :1] + np.sin(X[:, 1:2]) + 0.2 * rng.randn(N, 1))
+    B = np.linalg.qr(rng.randn(P, ndr))[0]
+    return B, X, Y
+
+
+def survival(N=600, P=4, ndr=2, seed=2):
+    rng = np.random.RandomState(seed)
+    X = rng.randn(N, P)
+    time = np.exp(X[:, 0] + 0.5 * rng.randn(N))
+    order = np.argsort(time)
+    X = X[order]
+    status = rng.rand(N) < 0.7
+    fail = np.flatnonzero(status) + 1.0
+    Phit = rng.randn(3, fail.size)
+    B = np.linalg.qr(rng.randn(P, ndr))[0]
+    return B, X, Phit, fail
+
+
+def opts(parallel):
+    kopt = aw.kernel_opts()
+    kopt.parallel = parallel
+    return kopt
+
+
+@pytest.mark.parametrize("init", [aw._sir_init, aw._save_init, aw._phd_init, aw._seff_init, aw._local_f])
+def test_objective_same_for_any_ncore(init):
+    B, X, Y = regression()
+    one = init(B, X, Y, 0.4, 1, opts("rows"))
+    many = init(B, X, Y, 0.4, NCORE, opts("rows"))
+
+    assert one == many
+
+
+@pytest.mark.parametrize("parallel", ["coordinates", "rows", "hybrid"])
+@pytest.mark.parametrize("solver", [aw._sir_solver, aw._save_solver, aw._phd_solver, aw._seff_solver,
+                                    aw._local_solver])
+def test_regression_fit_same_for_any_ncore(solver, parallel):
+    B, X, Y = regression()
+
+    # a few iterations, each one takes the gradient of every coordinate
+    one = solver(B, X, Y, 0.4, *SOLVER, 1, opts(parallel))
+    many = solver(B, X, Y, 0.4, *SOLVER, NCORE, opts(parallel))
+
+    assert one["fn"] == many["fn"]
+    assert np.array_equal(one["B"], many["B"])
+
+
+@pytest.mark.parametrize("parallel", ["coordinates", "rows", "hybrid"])
+@pytest.mark.parametrize("method", ["dn", "dm", "forward"])
+def test_survival_fit_same_for_any_ncore(method, parallel):
+    B, X, Phit, fail = survival()
+
+    def fit(ncore):
+        if method == "dn":
+            return aw._surv_dn_solver(B, X, Phit, fail, 0.4, *SOLVER, ncore, opts(parallel))
+        if method == "dm":
+            return aw._surv_dm_solver(B, X, Phit, fail, 0.4, *SOLVER, ncore, opts(parallel))
+        return aw._surv_forward_solver(B, X, fail, 0.4, *SOLVER, ncore, opts(parallel))
+
+    one = fit(1)
+    many = fit(NCORE)
+
+    assert one["fn"] == many["fn"]
+    assert np.array_equal(one["B"], many["B"])
@@ -0,0 +1,91 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+from test.reference import kernel_dense
+
+
+def backend_data(N=600, ndr=2, seed=7):
+    # scaled points with a few dozen effective neighbors each
+    rng = np.random.RandomState(seed)
+    return rng.randn(N, ndr) * 1.5, rng.randn(N, 3)
+
+
+def kernel_prod(Z, R, backend, **opts):
+    kopt = aw.kernel_opts()
+    kopt.backend = backend
+    for key, value in opts.items():
+        setattr(kopt, key, value)
+    return aw._kernel_prod(Z, R, 1.0, 2, kopt)
+
+
+def assert_entry_bound(KR, KR_exact, R, tol):
+    # every kernel entry within tol moves row i of K R by at most tol * sum_j |R_j|
+    bound = tol * np.abs(R).sum(0)
+    assert np.all(np.abs(KR - KR_exact) <= bound[None, :] * (1 + 1e-8) + 1e-12)
+
+
+@pytest.mark.parametrize("ndr", [2, 4])
+@pytest.mark.parametrize("tol", [1e-3, 1e-6])
+def test_tree_within_tol(ndr, tol):
+    Z, R = backend_data(ndr=ndr)
+    assert_entry_bound(kernel_prod(Z, R, "tree", tol=tol), kernel_prod(Z, R, "exact"), R, tol)
+
+
+@pytest.mark.parametrize("ndr", [1, 2, 3])
+@pytest.mark.parametrize("tol", [1e-3, 1e-6])
+def test_ifgt_within_tol(ndr, tol):
+    # enough points for the expansions to beat the direct sums
+    Z, R = backend_data(N=2000, ndr=ndr)
+    assert_entry_bound(kernel_prod(Z, R, "ifgt", tol=tol), kernel_prod(Z, R, "exact"), R, tol)
+
+
+@pytest.mark.parametrize("ndr", [1, 2])
+@pytest.mark.parametrize("tol", [1e-2, 1e-3])
+def test_binned_within_tol(ndr, tol):
+    Z, R = backend_data(ndr=ndr)
+    KR_exact = kernel_prod(Z, R, "exact")
+    assert_entry_bound(kernel_prod(Z, R, "binned", tol=tol), KR_exact, R, tol)
+
+    # a grid finer than the one picked from tol keeps the bound
+    bins = int(np.ceil((np.ptp(Z, 0) / np.sqrt(2 * tol / ndr)).max())) * 2
+    assert_entry_bound(kernel_prod(Z, R, "binned", tol=tol, grid=bins), KR_exact, R, tol)
+
+
+@pytest.mark.parametrize("tol", [1e-3, 1e-8])
+def test_nystrom_landmarks(tol):
+    Z, R = backend_data()
+    N = Z.shape[0]
+    KR_exact = kernel_prod(Z, R, "exact")
+
+    # with every row a landmark only the eigenvalues under tol * lambda_max are
+    # dropped, and the exact diagonal moves K by as much again
+    KR = kernel_prod(Z, R, "nystrom", tol=tol, landmarks=N)
+    lam = np.linalg.eigvalsh(kernel_dense(Z)).max()
+    err = np.linalg.norm(KR - KR_exact, axis=0)
+    assert np.all(err <= 2 * tol * lam * np.linalg.norm(R, axis=0) * (1 + 1e-8) + 1e-10)
+
+    # fewer landmarks, a coarser factor
+    coarse = [np.linalg.norm(kernel_prod(Z, R, "nystrom", tol=tol, landmarks=m, landmark="kmeans++") - KR_exact)
+              for m in (300, 30)]
+    assert coarse[0] < coarse[1]
+
+
+def test_rff_features_and_seed():
+    Z, R = backend_data(N=300)
+    N = Z.shape[0]
+    KR_exact = kernel_prod(Z, R, "exact")
+
+    # each entry is the mean of D terms 2 cos(.) cos(.) in [-2, 2]: by Hoeffding and a union
+    # bound over the N^2 entries all are within eps with probability 1 - 1e-6
+    D = 2048
+    eps = np.sqrt(8 * np.log(2 * N * N / 1e-6) / D)
+    KR = kernel_prod(Z, R, "rff", features=D, seed=3)
+    assert_entry_bound(KR, KR_exact, R, eps)
+
+    # the draws follow the seed only
+    assert np.array_equal(KR, kernel_prod(Z, R, "rff", features=D, seed=3))
+    assert not np.allclose(KR, kernel_prod(Z, R, "rff", features=D, seed=4))
+
+    # the error falls like 1 / sqrt(D)
+    err = [np.linalg.norm(kernel_prod(Z, R, "rff", features=d, seed=3) - KR_exact) for d in (4096, 128)]
+    assert err[0] < 0.5 * err[1]
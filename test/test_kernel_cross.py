@@ -0,0 +1,39 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+
+
+def cross_data(seed=8):
+    rng = np.random.RandomState(seed)
+    X = rng.randn(300, 3)
+    TestX = rng.randn(130, 3) + 0.3
+    Y = rng.randn(300, 2)
+    return TestX, X, Y
+
+
+def test_cross_matches_gaussian():
+    TestX, X, Y = cross_data()
+    K = aw._KernelDist_cross(TestX, X, 2)
+
+    assert np.allclose(K, np.exp(-((TestX[:, None, :] - X[None, :, :]) ** 2).sum(-1)), rtol=1e-12, atol=1e-15)
+
+
+@pytest.mark.parametrize("block", [0, 7, 130, 500])
+def test_blocks_concatenate_to_dense(block):
+    TestX, X, Y = cross_data()
+    K = aw._KernelDist_cross(TestX, X, 2)
+
+    first, blocks = [], []
+    aw._KernelDist_cross_blocks(TestX, X, block, lambda i0, Kb: (first.append(i0), blocks.append(np.array(Kb))), 2)
+
+    # in order, without gaps, the same entries as the dense matrix
+    assert first == list(np.cumsum([0] + [b.shape[0] for b in blocks[:-1]]))
+    assert np.allclose(np.vstack(blocks), K, rtol=1e-12, atol=1e-15)
+
+
+def test_predict_and_rowsum_match_dense():
+    TestX, X, Y = cross_data()
+    K = aw._KernelDist_cross(TestX, X, 2)
+
+    assert np.allclose(aw._KernelDist_cross_rowsum(TestX, X, 2), K.sum(1), rtol=1e-12, atol=0)
+    assert np.allclose(aw._KernelDist_cross_predict(TestX, X, Y, 2), K @ Y / K.sum(1)[:, None], rtol=1e-10, atol=1e-12)
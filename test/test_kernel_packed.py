@@ -0,0 +1,30 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+from test.reference import kernel_dense
+
+
+@pytest.mark.parametrize("single", [False, True])
+@pytest.mark.parametrize("tile", [16, 0])
+def test_packed_matches_dense(single, tile):
+    rng = np.random.RandomState(9)
+    N = 203
+    X = rng.randn(N, 2)
+    R = rng.randn(N, 3)
+    K = kernel_dense(X, "gaussian", 0.5)
+
+    packed = aw._packed_kernel(X, R, 0.5, 2, single, tile)
+    rtol = 1e-6 if single else 1e-13
+
+    # the upper triangle tiles read back as the full symmetric matrix, uneven last tile included
+    assert np.allclose(packed["cols"], K, rtol=rtol, atol=1e-15)
+    assert np.allclose(packed["entries"], K, rtol=rtol, atol=1e-15)
+    assert np.allclose(packed["mult"], K @ R, rtol=10 * rtol, atol=10 * rtol * np.abs(K) @ np.abs(R))
+    assert np.allclose(np.asarray(packed["rowsum"]).ravel(), K.sum(1), rtol=10 * rtol, atol=0)
+
+    # only the tiles on and above the diagonal are stored
+    T = packed["tile"]
+    nb = -(-N // T)
+    sizes = [min(T, N - b * T) for b in range(nb)]
+    stored = sum(sizes[i] * sizes[j] for i in range(nb) for j in range(i, nb))
+    assert packed["bytes"] == stored * (4 if single else 8)
@@ -0,0 +1,49 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+
+
+def plan(method, N, P, ndr, ncore, memory, backend="exact"):
+    kopt = aw.kernel_opts()
+    kopt.backend = backend
+    kopt.memory = memory
+    return aw._kernel_plan(method, N, P, ndr, ncore, kopt)
+
+
+def test_budget_lowers_threads():
+    full = plan("save", 2000, 10, 2, 8, 1e12)
+    assert full["fits"] and full["adjusted"] == "none"
+    assert full["total_threads"] > 1
+
+    # room for the shared data and about one and a half evaluations
+    budget = full["shared_bytes"] + 1.5 * plan("save", 2000, 10, 2, 1, 1e12)["eval_bytes"]
+    small = plan("save", 2000, 10, 2, 8, budget)
+
+    assert small["adjusted"] == "threads"
+    assert small["fits"]
+    assert small["total_threads"] < full["total_threads"]
+    assert small["peak_bytes"] <= budget
+
+    # a lone evaluation (initial value, line search) splits the rows under the same budget
+    assert full["eval_threads"] > 1
+    assert 1 <= small["eval_threads"] <= full["eval_threads"]
+
+
+def test_budget_too_small_is_reported():
+    tiny = plan("seff", 2000, 10, 2, 4, 1e5)
+    assert not tiny["fits"]
+    assert tiny["total_threads"] == 1
+    assert tiny["eval_threads"] == 1
+
+
+def test_prepare_over_budget_raises():
+    rng = np.random.RandomState(1)
+    X = rng.randn(500, 4)
+    Y = rng.randn(500, 1)
+
+    kopt = aw.kernel_opts()
+    kopt.memory = 1e5
+
+    # the packed Y kernel of seff alone is over the budget
+    with pytest.raises(RuntimeError, match="memory budget"):
+        aw.problem("seff", X, Y, 1, kopt)
@@ -0,0 +1,21 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+from test.reference import kernel_dense
+
+
+@pytest.mark.parametrize("kernel", ["epanechnikov", "biweight", "triweight", "epan_legacy"])
+@pytest.mark.parametrize("ndr", [1, 2, 3])
+def test_compact_kernel_matches_dense(kernel, ndr):
+    rng = np.random.RandomState(ndr)
+    N = 400
+
+    # a few dozen neighbors within the unit support in every dimension
+    Z = rng.rand(N, ndr) * (N / 40.0) ** (1.0 / ndr)
+    R = rng.randn(N, 3)
+
+    kopt = aw.kernel_opts()
+    kopt.kernel = kernel
+
+    KR = aw._kernel_prod(Z, R, 0.5, 2, kopt)
+    assert np.allclose(KR, kernel_dense(Z, kernel, 0.5) @ R, rtol=1e-12, atol=1e-12)
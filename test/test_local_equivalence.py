@@ -0,0 +1,16 @@
+import test.cpp_exports as aw
+from test.reference import regression, local_dense, seff_dense, assert_same_objective
+
+
+def test_local_matches_per_point_solves():
+    B, X, Y = regression()
+
+    assert_same_objective(lambda B: aw._local_f(B, X, Y, 0.5, 1),
+                          lambda B: local_dense(B, X, Y, 0.5), B)
+
+
+def test_seff_matches_per_point_solves():
+    B, X, Y = regression()
+
+    assert_same_objective(lambda B: aw._seff_init(B, X, Y, 0.5, 1),
+                          lambda B: seff_dense(B, X, Y, 0.5), B)
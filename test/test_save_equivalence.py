@@ -0,0 +1,17 @@
+import test.cpp_exports as aw
+from test.reference import regression, save_dense, assert_same_objective
+
+
+def test_save_matches_covariance_cubes():
+    B, X, Y = regression()
+
+    assert_same_objective(lambda B: aw._save_init(B, X, Y, 0.5, 1),
+                          lambda B: save_dense(B, X, Y, 0.5), B)
+
+
+def test_save_blocks_match_covariance_cubes():
+    # more coordinates than fit in one kernel pass of the products X_p X
+    B, X, Y = regression(N=120, P=12, ndr=2)
+
+    assert_same_objective(lambda B: aw._save_init(B, X, Y, 0.5, 1),
+                          lambda B: save_dense(B, X, Y, 0.5), B)
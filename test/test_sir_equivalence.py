@@ -0,0 +1,9 @@
+import test.cpp_exports as aw
+from test.reference import regression, sir_dense, assert_same_objective
+
+
+def test_sir_matches_dense_formulation():
+    B, X, Y = regression()
+
+    assert_same_objective(lambda B: aw._sir_init(B, X, Y, 0.5, 1),
+                          lambda B: sir_dense(B, X, Y, 0.5), B)
@@ -0,0 +1,64 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+
+
+def tied_survival(N=200, P=3, seed=3):
+    # times on a coarse grid, so most failures share their time with others
+    rng = np.random.RandomState(seed)
+    X = rng.randn(N, P)
+    time = np.round(np.exp(X[:, 0] + 0.5 * rng.randn(N)) * 10) / 10
+    status = (rng.rand(N) < 0.7).astype(float)
+    B = np.linalg.qr(rng.randn(P, 2))[0]
+    return B, X, time, status
+
+
+def solve(prob, method, B):
+    # objective at B: no iterations
+    return prob.solve(method, B, 0.5, 1.0, 0.2, 0.85, 1e-3, 1e-5, 1e-6, 1e-6, 1e-6, 0, 0, 1)
+
+
+def test_quantile_bins_keep_tie_runs():
+    B, X, time, status = tied_survival()
+    exact = aw.surv_problem(time, status, X, "mean", 2, 0)
+    binned = aw.surv_problem(time, status, X, "mean", 2, 6)
+
+    assert binned.bins == 6
+    assert np.array_equal(binned.fail_ind, exact.fail_ind)
+
+    groups = binned.tie_group.astype(int)
+    assert groups[0] == 0 and np.all(np.diff(groups) >= 0)
+    assert groups[-1] + 1 <= 6
+
+    # a run of tied failures never straddles two bins
+    for g in np.unique(exact.tie_group):
+        assert np.unique(groups[exact.tie_group == g]).size == 1
+
+    # each bin takes the risk set of its first failure and the mean Phit of its failures
+    for b in np.unique(groups):
+        members = np.flatnonzero(groups == b)
+        assert np.all(binned.risk_ind[members] == exact.risk_ind[members[0]])
+        assert np.allclose(binned.Phit[:, members], exact.Phit[:, members].mean(1)[:, None])
+
+
+def test_dm_reports_binned_against_exact():
+    B, X, time, status = tied_survival()
+    exact = aw.surv_problem(time, status, X, "mean", 2, 0)
+    binned = aw.surv_problem(time, status, X, "mean", 2, 6)
+
+    fit = solve(binned, "dm", B)
+    report = fit["binning"]
+
+    assert report["bins"] == 6
+    assert report["fn_binned"] == fit["fn"]
+    assert np.isclose(report["fn_exact"], solve(exact, "dm", B)["fn"], rtol=1e-10)
+    assert "binning" not in solve(exact, "dm", B)
+
+
+@pytest.mark.parametrize("method", ["dn", "forward"])
+def test_bins_rejected_outside_dm(method):
+    B, X, time, status = tied_survival()
+    binned = aw.surv_problem(time, status, X, "mean", 2, 6)
+
+    with pytest.raises(RuntimeError, match="only applies to the dm solver"):
+        solve(binned, method, B)
@@ -0,0 +1,18 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+from test.reference import survival, surv_solver_fn, surv_dm_dense, assert_same_objective
+
+
+def test_dm_matches_subject_loop():
+    B, X, Phit, Fail_Ind = survival()
+
+    assert_same_objective(lambda B: surv_solver_fn(aw._surv_dm_solver, B, X, Phit, Fail_Ind),
+                          lambda B: surv_dm_dense(B, X, Phit, Fail_Ind, 0.5), B)
+
+
+def test_dm_without_failures_raises():
+    B, X, Phit, Fail_Ind = survival()
+
+    with pytest.raises(RuntimeError, match="at least one failure"):
+        surv_solver_fn(aw._surv_dm_solver, B, X, np.zeros((X.shape[1], 0)), np.zeros(0))
@@ -0,0 +1,17 @@
+import test.cpp_exports as aw
+from test.reference import (survival, surv_solver_fn, surv_dn_dense, surv_forward_dense,
+                            assert_same_objective)
+
+
+def test_dn_matches_risk_set_loops():
+    B, X, Phit, Fail_Ind = survival()
+
+    assert_same_objective(lambda B: surv_solver_fn(aw._surv_dn_solver, B, X, Phit, Fail_Ind),
+                          lambda B: surv_dn_dense(B, X, Phit, Fail_Ind, 0.5), B)
+
+
+def test_forward_matches_risk_set_loops():
+    B, X, Phit, Fail_Ind = survival()
+
+    assert_same_objective(lambda B: surv_solver_fn(aw._surv_forward_solver, B, X, Fail_Ind),
+                          lambda B: surv_forward_dense(B, X, Fail_Ind, 0.5), B)
@@ -0,0 +1,86 @@
+import numpy as np
+import pytest
+import test.cpp_exports as aw
+from test.reference import surv_solver_fn
+
+
+def test_tied_and_censored_order():
+    # time 1: rows 1 (failure), 3 (failure); time 2: rows 2, 5 (failures), 0 (censored); time 3: row 4
+    time = np.array([2.0, 1.0, 2.0, 1.0, 3.0, 2.0])
+    status = np.array([0.0, 1.0, 1.0, 1.0, 1.0, 1.0])
+    X = np.arange(12.0).reshape(6, 2)
+
+    prob = aw.surv_problem(time, status, X, "mean", 2, 0)
+
+    assert np.array_equal(prob.order, [1, 3, 2, 5, 0, 4])
+    assert np.array_equal(prob.X, X[[1, 3, 2, 5, 0, 4]])
+    assert np.array_equal(prob.fail_ind, [0, 1, 2, 3, 5])
+    assert np.array_equal(prob.risk_ind, [0, 0, 2, 2, 5])
+    assert np.array_equal(prob.tie_group, [0, 0, 1, 1, 2])
+
+
+def test_sort_ties_and_mean_phit():
+    rng = np.random.RandomState(4)
+    N = 120
+    X = rng.randn(N, 3)
+    time = rng.randint(0, 15, N).astype(float)
+    status = (rng.rand(N) < 0.6).astype(float)
+
+    prob = aw.surv_problem(time, status, X, "mean", 2, 0)
+    order = prob.order.astype(int)
+    t, s = time[order], status[order]
+
+    # stable sort by time, failures before censored rows at a tied time
+    assert np.array_equal(order, np.lexsort((np.arange(N), -status, time)))
+    assert np.array_equal(prob.time, t)
+
+    fail = prob.fail_ind.astype(int)
+    assert np.array_equal(fail, np.flatnonzero(s == 1))
+
+    # the risk set of a failure starts at the first row with its time
+    first = np.searchsorted(t, t[fail], side="left")
+    assert np.array_equal(prob.risk_ind, first)
+
+    # one group per distinct failure time
+    assert np.array_equal(prob.tie_group, np.unique(t[fail], return_inverse=True)[1])
+
+    # Phit is the risk set average of X
+    Phit = np.column_stack([prob.X[r:].mean(0) for r in first])
+    assert np.allclose(prob.Phit, Phit, rtol=1e-12, atol=1e-12)
+
+
+def test_poly_phit():
+    rng = np.random.RandomState(5)
+    N = 60
+    X = rng.randn(N, 2)
+    time = rng.rand(N) * 5
+    status = (rng.rand(N) < 0.7).astype(float)
+
+    prob = aw.surv_problem(time, status, X, "poly", 3, 0)
+    tf = prob.time[prob.fail_ind.astype(int)] / time.max()
+
+    assert prob.Phit.shape == (4, tf.size)
+    assert np.allclose(prob.Phit, np.vstack([tf ** d for d in range(4)]), rtol=1e-12, atol=0)
+
+
+@pytest.mark.parametrize("method", ["dn", "dm", "forward"])
+def test_without_ties_matches_indexed(method):
+    rng = np.random.RandomState(6)
+    N, P = 150, 4
+    X = rng.randn(N, P)
+    time = np.exp(X[:, 0] + 0.5 * rng.randn(N))
+    status = (rng.rand(N) < 0.7).astype(float)
+    B = np.linalg.qr(rng.randn(P, 2))[0]
+
+    prob = aw.surv_problem(time, status, X, "mean", 2, 0)
+    Fail_Ind = prob.fail_ind + 1.0
+
+    fn = prob.solve(method, B, 0.5, 1.0, 0.2, 0.85, 1e-3, 1e-5, 1e-6, 1e-6, 1e-6, 0, 0, 1)["fn"]
+
+    if method == "forward":
+        ref = surv_solver_fn(aw._surv_forward_solver, B, prob.X, Fail_Ind)
+    else:
+        solver = aw._surv_dn_solver if method == "dn" else aw._surv_dm_solver
+        ref = surv_solver_fn(solver, B, prob.X, prob.Phit, Fail_Ind)
+
+    assert np.isclose(fn, ref, rtol=1e-12, atol=0)
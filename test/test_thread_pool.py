@@ -0,0 +1,34 @@
+import os
+import subprocess
+import sys
+
+import pytest
+
+# a fresh interpreter, so the pool starts empty and without a limit
+HYBRID = """
+import numpy as np
+import test.cpp_exports as aw
+
+rng = np.random.RandomState(1)
+X = rng.randn(2000, 2)
+Y = X[:, :1] + 0.1 * rng.randn(2000, 1)
+B = np.array([[1.0], [0.0]])
+
+kopt = aw.kernel_opts()
+kopt.parallel = "hybrid"
+
+fit = aw._sir_solver(B, X, Y, 0.5, 1.0, 0.2, 0.85, 1e-3, 1e-5, 1e-6, 1e-6, 1e-6, 2, 0, 4, kopt)
+print(fit["plan"]["outer_threads"], fit["plan"]["inner_threads"], aw._thread_pool_info()["threads"])
+"""
+
+
+@pytest.mark.skipif((os.cpu_count() or 1) < 4, reason="needs 4 cores")
+def test_hybrid_plan_grows_pool_to_all_threads():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    out = subprocess.run([sys.executable, "-c", HYBRID], cwd=root, check=True,
+                         capture_output=True, text=True).stdout.split()
+    outer, inner, threads = (int(v) for v in out)
+
+    # two coordinates of B, each evaluated on two row threads
+    assert (outer, inner) == (2, 2)
+    assert threads == outer * inner